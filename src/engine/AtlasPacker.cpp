@@ -0,0 +1,108 @@
+#include "AtlasPacker.h"
+
+#include <algorithm>
+
+AtlasPacker::AtlasPacker(int width, int height)
+	: mWidth(width), mHeight(height)
+{
+	mSkyline.push_back({0, 0, width});
+}
+
+int AtlasPacker::fitAt(size_t index, int width, int height) const
+{
+	const int x = mSkyline[index].x;
+	if (x + width > mWidth)
+		return -1;
+
+	// Rest on the highest segment under the rect
+	int y = 0;
+	int remaining = width;
+	for (size_t i = index; remaining > 0; ++i)
+	{
+		y = std::max(y, mSkyline[i].y);
+		if (y + height > mHeight)
+			return -1;
+
+		remaining -= mSkyline[i].width;
+	}
+
+	return y;
+}
+
+bool AtlasPacker::pack(int width, int height, int &x, int &y)
+{
+	if (width <= 0 || height <= 0)
+		return false;
+
+	// Lowest top edge wins, ties go to the narrower segment to leave wide
+	// ones for wide rects
+	size_t bestIndex = mSkyline.size();
+	int bestTop = mHeight + 1;
+	int bestWidth = 0;
+
+	for (size_t i = 0; i < mSkyline.size(); ++i)
+	{
+		const int fitY = fitAt(i, width, height);
+		if (fitY < 0)
+			continue;
+
+		const int top = fitY + height;
+		if (top < bestTop ||
+			(top == bestTop && mSkyline[i].width < bestWidth))
+		{
+			bestIndex = i;
+			bestTop = top;
+			bestWidth = mSkyline[i].width;
+		}
+	}
+
+	if (bestIndex == mSkyline.size())
+		return false;
+
+	x = mSkyline[bestIndex].x;
+	y = bestTop - height;
+
+	// Raise the skyline under the rect
+	mSkyline.insert(mSkyline.begin() + bestIndex, {x, bestTop, width});
+
+	// Trim or drop the segments it now covers
+	for (size_t i = bestIndex + 1; i < mSkyline.size();)
+	{
+		Segment &s = mSkyline[i];
+		const int covered = x + width - s.x;
+		if (covered <= 0)
+			break;
+
+		if (covered < s.width)
+		{
+			s.x += covered;
+			s.width -= covered;
+			break;
+		}
+
+		mSkyline.erase(mSkyline.begin() + i);
+	}
+
+	// Merge neighbours at the same height
+	for (size_t i = 0; i + 1 < mSkyline.size();)
+	{
+		if (mSkyline[i].y == mSkyline[i + 1].y)
+		{
+			mSkyline[i].width += mSkyline[i + 1].width;
+			mSkyline.erase(mSkyline.begin() + i + 1);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	mUsedArea += int64_t(width) * height;
+	return true;
+}
+
+float AtlasPacker::occupancy() const
+{
+	return static_cast<float>(mUsedArea) /
+		   (static_cast<float>(mWidth) * static_cast<float>(mHeight));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Skyline bottom-left rectangle packer. Tracks the top edge of everything
+// packed so far as a list of horizontal segments and places each rect
+// where it ends up lowest. Space is never reclaimed.
+class AtlasPacker
+{
+  public:
+	AtlasPacker(int width, int height);
+
+	// Finds room for a width x height rect, returns false if it doesn't fit
+	bool pack(int width, int height, int &x, int &y);
+
+	int width() const { return mWidth; }
+	int height() const { return mHeight; }
+
+	// Fraction of the page covered by packed rects
+	float occupancy() const;
+
+  private:
+	struct Segment
+	{
+		int x;
+		int y; // top of the skyline along [x, x + width)
+		int width;
+	};
+
+	// y a rect of the given width would sit at if placed at segment index,
+	// or -1 if it runs off the page
+	int fitAt(size_t index, int width, int height) const;
+
+	int mWidth;
+	int mHeight;
+	int64_t mUsedArea = 0;
+
+	std::vector<Segment> mSkyline;
+};
@@ -138,6 +138,20 @@ void Editor::draw()
 
 void Editor::endFrame()
 {
+	auto *renderer = Engine::instance->renderer.get();
+
 	ImGui::Render();
-	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	ImDrawData *drawData = ImGui::GetDrawData();
+
+	renderer->beginPass(RenderPass::Editor);
+	ImGui_ImplOpenGL3_RenderDrawData(drawData);
+	renderer->endPass(RenderPass::Editor);
+
+	// The ImGui backend draws with GL directly, count its draws here
+	uint32_t drawCalls = 0;
+	for (const ImDrawList *list : drawData->CmdLists)
+		drawCalls += static_cast<uint32_t>(list->CmdBuffer.Size);
+
+	renderer->countDraws(RenderPass::Editor, drawCalls,
+						 static_cast<uint64_t>(drawData->TotalIdxCount) / 3);
 }
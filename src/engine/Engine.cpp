@@ -1,4 +1,5 @@
 #include "Engine.h"
+#include "Profiler.h"
 
 #include <glad/glad.h>
 #include <iostream>
@@ -14,6 +15,8 @@ Engine::~Engine()
 		world.reset();
 	}
 
+	jobs.reset();
+
 	testUI->Shutdown();
 	testUI.reset();
 
@@ -45,8 +48,17 @@ Engine::~Engine()
 	instance = nullptr;
 }
 
-bool Engine::init()
+bool Engine::init(bool _headless)
 {
+	headless = _headless;
+
+#ifdef __linux__
+	// Build machines have no display, SDL's offscreen driver gets a GL
+	// context through EGL instead (surfaceless on Mesa)
+	if (headless && !SDL_getenv("DISPLAY") && !SDL_getenv("WAYLAND_DISPLAY"))
+		SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "offscreen");
+#endif
+
 	if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMEPAD))
 	{
 		std::cerr << "SDL_Init failed: " << SDL_GetError() << "\n";
@@ -58,7 +70,11 @@ bool Engine::init()
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
 						SDL_GL_CONTEXT_PROFILE_CORE);
 
-	window = SDL_CreateWindow("SillyGame", 1280, 720, SDL_WINDOW_OPENGL);
+	SDL_WindowFlags windowFlags = SDL_WINDOW_OPENGL;
+	if (headless)
+		windowFlags |= SDL_WINDOW_HIDDEN;
+
+	window = SDL_CreateWindow("SillyGame", 1280, 720, windowFlags);
 	if (!window)
 	{
 		std::cerr << "SDL_CreateWindow failed: " << SDL_GetError() << "\n";
@@ -84,14 +100,22 @@ bool Engine::init()
 #if WITH_EDITOR
 	editor = std::make_unique<Editor>();
 	editor->init(window, glContext);
+	Profiler::registerEditorTool(*editor);
 #endif
 
+	jobs = std::make_unique<JobSystem>();
+
 	input = std::make_unique<Input>();
 
 	camera = std::make_unique<Camera>();
 
 	renderer = std::make_unique<Renderer>();
-	renderer->init();
+	if (!renderer->init())
+		return false;
+
+	// A hidden window's default framebuffer may not be backed at all
+	if (headless && !renderer->createOffscreenTarget(1280, 720))
+		return false;
 
 	testUI = std::make_unique<TestUI>();
 	testUI->Init();
@@ -102,5 +126,7 @@ bool Engine::init()
 void Engine::setWorld(std::unique_ptr<World> _world)
 {
 	world = std::move(_world);
+	world->setJobSystem(jobs.get());
+	world->setRenderer(renderer.get());
 	world->init();
 }
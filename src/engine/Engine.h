@@ -8,6 +8,7 @@
 #include "Camera.h"
 #include "Editor.h"
 #include "Input.h"
+#include "JobSystem.h"
 #include "Renderer.h"
 #include "World.h"
 #include "UI/UILayoutTest.h"
@@ -17,13 +18,15 @@ struct Engine
 	Engine() { instance = this; }
 	~Engine();
 
-	bool init();
+	// Headless creates a hidden window and renders offscreen
+	bool init(bool headless = false);
 	
 	void setWorld(std::unique_ptr<World> world);
 
 	SDL_Window *window = nullptr;
 	SDL_GLContext glContext = nullptr;
 
+	std::unique_ptr<JobSystem> jobs;
 	std::unique_ptr<Input> input;
 	std::unique_ptr<Camera> camera;
 	std::unique_ptr<Renderer> renderer;
@@ -34,6 +37,7 @@ struct Engine
 #endif
 
 	int mode = 0;
+	bool headless = false;
 
 	double fixedDelta = 1.0 / 60.0;
 	double accumulator = 0.0;
@@ -2,4 +2,7 @@
 
 #define WITH_EDITOR 1
 
+// Scoped CPU timers (PROFILE_SCOPE), compiled out when 0
+#define WITH_PROFILER 1
+
 #define GAMEDATA_DIR "gamedata/"
\ No newline at end of file
@@ -1,20 +1,54 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <glm/glm.hpp>
 
+class World;
+
 class Entity
 {
   public:
 	virtual ~Entity() = default;
 
+	// Set to true in a derived class whose update only touches its own
+	// state, World then updates that type across the job system. Shared
+	// state has to go through World::defer.
+	static constexpr bool kParallelUpdate = false;
+
 	virtual void update(float dt) {}
 	virtual void render() {}
 
-	void destroy() { mPendingDestroy = true; }
-	bool isPendingDestroy() const { return mPendingDestroy; }
+	// Marks the entity for destruction at the end of the world's tick.
+	// Defined inline in World.h, include that to call it.
+	inline void destroy();
+	bool isPendingDestroy() const { return mPendingDestroy.load(); }
+
+	// Called right before the entity is removed from the world
+	virtual void onDestroy() {}
+
+	// Sphere World::render culls against. Not virtual, pools call it on the
+	// concrete type, so a derived class can hide it with its own.
+	void boundingSphere(glm::vec3 &center, float &radius) const
+	{
+		center = position;
+		radius = boundingRadius;
+	}
 
 	glm::vec3 position = glm::vec3(0, 0, 0);
+	float boundingRadius = 1.f;
 
   private:
-	bool mPendingDestroy = false;
+	// Set once, destroy can be called from parallel updates
+	std::atomic<bool> mPendingDestroy{false};
+
+	friend class World;
+	World *mWorld = nullptr;
+	uint32_t mTypeId = 0; // which of the World's pools this lives in
+	uint32_t mSlot = 0;	  // slot in that pool
+
+	friend class SpatialHashGrid;
+	static constexpr uint32_t kNotInGrid = ~0u;
+	uint32_t mGridBucket = kNotInGrid;
+	uint32_t mGridSlot = 0;
 };
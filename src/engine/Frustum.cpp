@@ -0,0 +1,126 @@
+#include "Frustum.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) ||            \
+	defined(__i386__)
+#define FRUSTUM_SIMD_X86 1
+#include <emmintrin.h>
+#else
+#define FRUSTUM_SIMD_X86 0
+#endif
+
+Frustum Frustum::fromMatrix(const glm::mat4 &m)
+{
+	// Gribb/Hartmann: each plane is the last row of the matrix plus or
+	// minus one of the others (glm is column major, m[column][row])
+	auto row = [&m](int r)
+	{ return glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]); };
+
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0); // left
+	frustum.planes[1] = row(3) - row(0); // right
+	frustum.planes[2] = row(3) + row(1); // bottom
+	frustum.planes[3] = row(3) - row(1); // top
+	frustum.planes[4] = row(3) + row(2); // near
+	frustum.planes[5] = row(3) - row(2); // far
+
+	for (glm::vec4 &plane : frustum.planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	return frustum;
+}
+
+bool Frustum::intersectsSphere(glm::vec3 center, float radius) const
+{
+	for (const glm::vec4 &plane : planes)
+	{
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			return false;
+	}
+
+	return true;
+}
+
+bool Frustum::intersectsAabb(glm::vec3 min, glm::vec3 max) const
+{
+	for (const glm::vec4 &plane : planes)
+	{
+		// Corner furthest along the plane normal
+		const glm::vec3 corner(plane.x >= 0.f ? max.x : min.x,
+							   plane.y >= 0.f ? max.y : min.y,
+							   plane.z >= 0.f ? max.z : min.z);
+
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.f)
+			return false;
+	}
+
+	return true;
+}
+
+size_t Frustum::cullSpheresScalar(const float *x, const float *y,
+								  const float *z, const float *radius,
+								  size_t count, uint8_t *visible) const
+{
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const bool inside =
+			intersectsSphere(glm::vec3(x[i], y[i], z[i]), radius[i]);
+		visible[i] = inside ? 1 : 0;
+		visibleCount += inside;
+	}
+
+	return visibleCount;
+}
+
+size_t Frustum::cullSpheres(const float *x, const float *y, const float *z,
+							const float *radius, size_t count,
+							uint8_t *visible) const
+{
+#if FRUSTUM_SIMD_X86
+	// Plane components splatted once, each iteration tests 4 spheres
+	// against all 6 planes
+	__m128 px[6], py[6], pz[6], pw[6];
+	for (int p = 0; p < 6; ++p)
+	{
+		px[p] = _mm_set1_ps(planes[p].x);
+		py[p] = _mm_set1_ps(planes[p].y);
+		pz[p] = _mm_set1_ps(planes[p].z);
+		pw[p] = _mm_set1_ps(planes[p].w);
+	}
+
+	size_t visibleCount = 0;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 cx = _mm_loadu_ps(x + i);
+		const __m128 cy = _mm_loadu_ps(y + i);
+		const __m128 cz = _mm_loadu_ps(z + i);
+		const __m128 negRadius =
+			_mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(radius + i));
+
+		// Lanes stay set while every plane has the sphere inside or
+		// crossing it
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p)
+		{
+			// Same order of operations as intersectsSphere
+			__m128 d = _mm_mul_ps(px[p], cx);
+			d = _mm_add_ps(d, _mm_mul_ps(py[p], cy));
+			d = _mm_add_ps(d, _mm_mul_ps(pz[p], cz));
+			d = _mm_add_ps(d, pw[p]);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+		}
+
+		const int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; lane < 4; ++lane)
+			visible[i + lane] = (mask >> lane) & 1;
+		visibleCount += ((mask >> 0) & 1) + ((mask >> 1) & 1) +
+						((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+
+	return visibleCount + cullSpheresScalar(x + i, y + i, z + i, radius + i,
+											count - i, visible + i);
+#else
+	return cullSpheresScalar(x, y, z, radius, count, visible);
+#endif
+}
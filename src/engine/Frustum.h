@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// View frustum as six planes with normals pointing inwards. Points with
+// dot(plane.xyz, p) + plane.w >= 0 are on the inside of a plane, planes
+// are normalized so that's a distance in world units.
+struct Frustum
+{
+	// All planes zero, everything is inside
+	Frustum()
+	{
+		for (glm::vec4 &plane : planes)
+			plane = glm::vec4(0.f);
+	}
+
+	glm::vec4 planes[6];
+
+	// Planes of a projection * view matrix (OpenGL clip space)
+	static Frustum fromMatrix(const glm::mat4 &viewProjection);
+
+	bool intersectsSphere(glm::vec3 center, float radius) const;
+	bool intersectsAabb(glm::vec3 min, glm::vec3 max) const;
+
+	// Tests count spheres stored as separate arrays, sets visible[i] to 1
+	// if sphere i is at least partly inside and 0 otherwise. Returns how
+	// many are visible. Four spheres per iteration with SSE.
+	size_t cullSpheres(const float *x, const float *y, const float *z,
+					   const float *radius, size_t count,
+					   uint8_t *visible) const;
+
+	// Scalar reference of cullSpheres, also the fallback
+	size_t cullSpheresScalar(const float *x, const float *y, const float *z,
+							 const float *radius, size_t count,
+							 uint8_t *visible) const;
+};
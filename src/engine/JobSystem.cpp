@@ -0,0 +1,201 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+static thread_local unsigned tThreadIndex = 0;
+
+JobSystem::JobSystem(unsigned workerCount)
+{
+	if (workerCount == 0)
+	{
+		unsigned hardware = std::thread::hardware_concurrency();
+		workerCount = hardware > 1 ? hardware - 1 : 1;
+	}
+
+	for (unsigned i = 0; i < workerCount + 1; ++i)
+		mQueues.push_back(std::make_unique<Queue>());
+
+	for (unsigned i = 1; i <= workerCount; ++i)
+		mWorkers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mRunning = false;
+	}
+	mWake.notify_all();
+
+	for (auto &worker : mWorkers)
+		worker.join();
+}
+
+unsigned JobSystem::currentThreadIndex() { return tThreadIndex; }
+
+void JobSystem::run(std::function<void()> job, JobCounter *counter,
+					JobCounter *dependency)
+{
+	if (counter)
+		counter->mPending.fetch_add(1, std::memory_order_relaxed);
+
+	if (dependency)
+	{
+		std::lock_guard<std::mutex> lock(dependency->mMutex);
+		if (!dependency->done())
+		{
+			// Queued by execute() when the dependency finishes
+			dependency->mContinuations.push_back(
+				[this, job = std::move(job), counter]() mutable
+				{ push({std::move(job), counter}); });
+			return;
+		}
+	}
+
+	push({std::move(job), counter});
+}
+
+void JobSystem::push(Job job)
+{
+	Queue &queue = *mQueues[tThreadIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(job));
+	}
+
+	mQueuedJobs.fetch_add(1, std::memory_order_release);
+
+	{
+		// Lock so a worker can't miss the wakeup between checking
+		// mQueuedJobs and going to sleep
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWake.notify_one();
+}
+
+bool JobSystem::tryRunOne(const JobCounter *onlyCounter)
+{
+	Job job;
+	bool found = false;
+
+	auto matches = [onlyCounter](const Job &queued)
+	{ return !onlyCounter || queued.counter == onlyCounter; };
+
+	// Own queue first, newest job (still warm in cache)
+	{
+		Queue &own = *mQueues[tThreadIndex];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		auto it = std::find_if(own.jobs.rbegin(), own.jobs.rend(), matches);
+		if (it != own.jobs.rend())
+		{
+			job = std::move(*it);
+			own.jobs.erase(std::next(it).base());
+			found = true;
+		}
+	}
+
+	// Then steal the oldest job from someone else
+	const size_t queueCount = mQueues.size();
+	for (size_t i = 1; !found && i < queueCount; ++i)
+	{
+		Queue &victim = *mQueues[(tThreadIndex + i) % queueCount];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		auto it = std::find_if(victim.jobs.begin(), victim.jobs.end(), matches);
+		if (it != victim.jobs.end())
+		{
+			job = std::move(*it);
+			victim.jobs.erase(it);
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	execute(job);
+	return true;
+}
+
+void JobSystem::execute(Job &job)
+{
+	job.fn();
+
+	JobCounter *counter = job.counter;
+	if (!counter)
+		return;
+
+	std::vector<std::function<void()>> continuations;
+	{
+		// Under the lock so run() can't add a continuation after we've
+		// already collected them
+		std::lock_guard<std::mutex> lock(counter->mMutex);
+		if (counter->mPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			continuations.swap(counter->mContinuations);
+	}
+
+	for (auto &continuation : continuations)
+		continuation();
+}
+
+void JobSystem::wait(JobCounter &counter)
+{
+	while (!counter.done())
+	{
+		if (!tryRunOne(&counter))
+			std::this_thread::yield();
+	}
+
+	// The last job may still be inside execute() holding the mutex, make
+	// sure it's out before the caller is free to destroy the counter
+	std::lock_guard<std::mutex> lock(counter.mMutex);
+}
+
+void JobSystem::parallelFor(size_t count, size_t grain,
+							const std::function<void(size_t, size_t)> &fn)
+{
+	if (count == 0)
+		return;
+
+	grain = std::max<size_t>(grain, 1);
+
+	// Not worth scheduling
+	if (count <= grain)
+	{
+		fn(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (size_t begin = 0; begin < count; begin += grain)
+	{
+		const size_t end = std::min(begin + grain, count);
+		run([&fn, begin, end]() { fn(begin, end); }, &counter);
+	}
+
+	wait(counter);
+}
+
+void JobSystem::workerLoop(unsigned index)
+{
+	tThreadIndex = index;
+
+	while (true)
+	{
+		if (tryRunOne())
+			continue;
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWake.wait(lock,
+				   [this]()
+				   {
+					   return !mRunning ||
+							  mQueuedJobs.load(std::memory_order_acquire) > 0;
+				   });
+
+		if (!mRunning)
+			return;
+	}
+}
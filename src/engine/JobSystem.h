@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts outstanding jobs. Jobs passed to run() with a counter increment it
+// and decrement it when they finish. Jobs can also be made to wait on a
+// counter, they are queued once it reaches zero.
+class JobCounter
+{
+  public:
+	bool done() const { return mPending.load(std::memory_order_acquire) == 0; }
+
+  private:
+	friend class JobSystem;
+
+	std::atomic<int> mPending{0};
+
+	std::mutex mMutex;
+	std::vector<std::function<void()>> mContinuations; // guarded by mMutex
+};
+
+// Work-stealing job scheduler. Each worker (and the main thread) owns a
+// deque, it pushes and pops its own work at the back and steals from the
+// front of other deques when it runs dry.
+class JobSystem
+{
+  public:
+	// 0 workers means one per hardware thread, minus the main thread
+	explicit JobSystem(unsigned workerCount = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem &) = delete;
+	JobSystem &operator=(const JobSystem &) = delete;
+
+	// Queues job. If counter is set it is incremented now and decremented
+	// when the job finishes. If dependency is set the job is only queued
+	// once dependency is done.
+	void run(std::function<void()> job, JobCounter *counter = nullptr,
+			 JobCounter *dependency = nullptr);
+
+	// Helps run counter's own jobs until it is done. Unrelated jobs are
+	// left to the workers, a long one (texture decode or cook) could stall
+	// the waiting thread well past the point counter finished.
+	void wait(JobCounter &counter);
+
+	// Calls fn(begin, end) over [0, count) in chunks of grain and waits.
+	// Chunk boundaries only depend on count and grain.
+	void parallelFor(size_t count, size_t grain,
+					 const std::function<void(size_t, size_t)> &fn);
+
+	// Threads jobs can run on, including the main thread
+	unsigned threadCount() const
+	{
+		return static_cast<unsigned>(mQueues.size());
+	}
+
+	// 0 on the main thread, 1..n on workers
+	static unsigned currentThreadIndex();
+
+  private:
+	struct Job
+	{
+		std::function<void()> fn;
+		JobCounter *counter = nullptr;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void push(Job job);
+	// Runs one queued job, only one counted by onlyCounter if set
+	bool tryRunOne(const JobCounter *onlyCounter = nullptr);
+	void execute(Job &job);
+	void workerLoop(unsigned index);
+
+	std::vector<std::unique_ptr<Queue>> mQueues; // [0] is the main thread
+	std::vector<std::thread> mWorkers;
+
+	std::atomic<int> mQueuedJobs{0};
+	std::atomic<bool> mRunning{true};
+
+	std::mutex mSleepMutex;
+	std::condition_variable mWake;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+  public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	// Returns false if the file can't be opened or is empty
+	bool open(const char *path);
+	void close() noexcept;
+
+	const uint8_t *data() const { return mData; }
+	size_t size() const { return mSize; }
+
+  private:
+	const uint8_t *mData = nullptr;
+	size_t mSize = 0;
+
+#ifdef _WIN32
+	void *mFile = nullptr;
+	void *mMapping = nullptr;
+#endif
+};
@@ -0,0 +1,486 @@
+#include "MeshAsset.h"
+
+#pragma warning(push)
+#pragma warning(disable : 26495)
+#pragma warning(disable : 6262)
+#pragma warning(disable : 6054)
+#define TINYOBJLOADER_IMPLEMENTATION
+#include <tiny_obj_loader.h>
+#pragma warning(pop)
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+MeshData importObj(const char *path)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+
+	std::string err;
+	bool ret = tinyobj::LoadObj(&attrib, &shapes, nullptr, &err, path);
+
+	if (!err.empty())
+	{
+		std::cerr << err << std::endl;
+	}
+
+	if (!ret)
+	{
+		std::stringstream ss;
+		ss << "Failed to load " << path;
+		throw std::runtime_error(ss.str());
+	}
+
+	if (shapes.size() > 1)
+	{
+		throw std::runtime_error("Right now only 1 shape is handled.");
+	}
+
+	// (position, normal, uv) index triple to vertex, open addressing with
+	// linear probing. Sized from the position count, unique vertices are
+	// usually close to it.
+	struct IndexKey
+	{
+		int v;
+		int n;
+		int t;
+	};
+
+	struct Bucket
+	{
+		IndexKey key;
+		uint32_t vertex; // kEmpty if unused
+	};
+
+	constexpr uint32_t kEmpty = ~0u;
+
+	auto hashKey = [](const IndexKey &k)
+	{
+		uint32_t h = static_cast<uint32_t>(k.v) * 0x9e3779b1u;
+		h ^= static_cast<uint32_t>(k.n) * 0x85ebca77u;
+		h ^= static_cast<uint32_t>(k.t) * 0xc2b2ae3du;
+		h ^= h >> 15;
+		h *= 0x2c1b3c6du;
+		h ^= h >> 12;
+		return h;
+	};
+
+	size_t capacity = 16;
+	while (capacity < attrib.vertices.size() / 3 * 2)
+		capacity *= 2;
+
+	std::vector<Bucket> buckets(capacity, Bucket{{}, kEmpty});
+
+	auto grow = [&]()
+	{
+		std::vector<Bucket> old(capacity * 2, Bucket{{}, kEmpty});
+		old.swap(buckets);
+		capacity *= 2;
+
+		for (const Bucket &b : old)
+		{
+			if (b.vertex == kEmpty)
+				continue;
+
+			size_t i = hashKey(b.key) & (capacity - 1);
+			while (buckets[i].vertex != kEmpty)
+				i = (i + 1) & (capacity - 1);
+			buckets[i] = b;
+		}
+	};
+
+	MeshData mesh;
+	auto &vertices = mesh.vertices;
+	auto &indices = mesh.indices;
+
+	for (const auto &shape : shapes)
+	{
+		indices.reserve(shape.mesh.indices.size());
+
+		for (const auto &idx : shape.mesh.indices)
+		{
+			IndexKey key{idx.vertex_index, idx.normal_index,
+						 idx.texcoord_index};
+
+			size_t i = hashKey(key) & (capacity - 1);
+			while (buckets[i].vertex != kEmpty &&
+				   (buckets[i].key.v != key.v || buckets[i].key.n != key.n ||
+					buckets[i].key.t != key.t))
+				i = (i + 1) & (capacity - 1);
+
+			if (buckets[i].vertex != kEmpty)
+			{
+				indices.push_back(buckets[i].vertex);
+				continue;
+			}
+
+			Vertex v{};
+
+			v.position[0] = attrib.vertices[3 * idx.vertex_index + 0];
+			v.position[1] = attrib.vertices[3 * idx.vertex_index + 1];
+			v.position[2] = attrib.vertices[3 * idx.vertex_index + 2];
+
+			if (idx.normal_index >= 0)
+			{
+				v.normal[0] = attrib.normals[3 * idx.normal_index + 0];
+				v.normal[1] = attrib.normals[3 * idx.normal_index + 1];
+				v.normal[2] = attrib.normals[3 * idx.normal_index + 2];
+			}
+
+			if (idx.texcoord_index >= 0)
+			{
+				v.uv[0] = attrib.texcoords[2 * idx.texcoord_index + 0];
+				v.uv[1] = attrib.texcoords[2 * idx.texcoord_index + 1];
+			}
+
+			uint32_t newIndex = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(v);
+			indices.push_back(newIndex);
+
+			buckets[i] = {key, newIndex};
+
+			// Keep the load factor at or under a half
+			if (vertices.size() * 2 > capacity)
+				grow();
+		}
+	}
+
+	if (!vertices.empty())
+	{
+		mesh.boundsMin = mesh.boundsMax = vertices[0].position;
+		for (const Vertex &v : vertices)
+		{
+			mesh.boundsMin = glm::min(mesh.boundsMin, v.position);
+			mesh.boundsMax = glm::max(mesh.boundsMax, v.position);
+		}
+	}
+
+	return mesh;
+}
+
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount)
+{
+	// Scoring from Tom Forsyth, "Linear-Speed Vertex Cache Optimisation"
+	constexpr int kCacheSize = 32;
+	constexpr int kMaxValence = 64;
+
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	static const auto tables = []()
+	{
+		struct
+		{
+			float cache[kCacheSize];
+			float valence[kMaxValence];
+		} t;
+
+		for (int i = 0; i < kCacheSize; ++i)
+		{
+			// The last triangle's vertices get a fixed score so we don't
+			// prefer them over slightly older ones (strips are worse)
+			if (i < 3)
+				t.cache[i] = 0.75f;
+			else
+				t.cache[i] =
+					std::pow(1.f - float(i - 3) / (kCacheSize - 3), 1.5f);
+		}
+
+		// Favour vertices with few triangles left, to finish them off
+		for (int i = 0; i < kMaxValence; ++i)
+			t.valence[i] = i == 0 ? 0.f : 2.f / std::sqrt(float(i));
+
+		return t;
+	}();
+
+	struct VertexInfo
+	{
+		int cachePos = -1;
+		uint32_t remaining = 0; // triangles not emitted yet
+		uint32_t firstTriangle = 0;
+		float score = 0.f;
+	};
+
+	std::vector<VertexInfo> verts(vertexCount);
+	for (uint32_t index : indices)
+		verts[index].remaining++;
+
+	// Triangles using each vertex, emitted ones are swapped past the end
+	std::vector<uint32_t> vertexTriangles(indices.size());
+	{
+		uint32_t offset = 0;
+		for (auto &v : verts)
+		{
+			v.firstTriangle = offset;
+			offset += v.remaining;
+			v.remaining = 0;
+		}
+
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				VertexInfo &v = verts[indices[t * 3 + k]];
+				vertexTriangles[v.firstTriangle + v.remaining++] =
+					static_cast<uint32_t>(t);
+			}
+		}
+	}
+
+	auto scoreOf = [&](const VertexInfo &v)
+	{
+		if (v.remaining == 0)
+			return -1.f;
+
+		float score = v.cachePos >= 0 ? tables.cache[v.cachePos] : 0.f;
+		return score + tables.valence[std::min<uint32_t>(v.remaining,
+														 kMaxValence - 1)];
+	};
+
+	for (auto &v : verts)
+		v.score = scoreOf(v);
+
+	std::vector<bool> emitted(triangleCount, false);
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+
+	uint32_t cache[kCacheSize + 3];
+	int cacheCount = 0;
+
+	size_t scanPos = 0; // everything before this has been emitted
+	int64_t best = -1;
+
+	for (size_t emittedCount = 0; emittedCount < triangleCount;
+		 ++emittedCount)
+	{
+		// Nothing good touched by the last triangle, take the next one
+		// in the original order
+		if (best < 0)
+		{
+			while (emitted[scanPos])
+				++scanPos;
+			best = static_cast<int64_t>(scanPos);
+		}
+
+		const size_t tri = static_cast<size_t>(best);
+		emitted[tri] = true;
+
+		uint32_t newCache[kCacheSize + 3];
+		int newCount = 0;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			const uint32_t index = indices[tri * 3 + k];
+			result.push_back(index);
+			newCache[newCount++] = index;
+
+			// Drop the triangle from the vertex's list
+			VertexInfo &v = verts[index];
+			uint32_t *list = &vertexTriangles[v.firstTriangle];
+			for (uint32_t i = 0; i < v.remaining; ++i)
+			{
+				if (list[i] == tri)
+				{
+					std::swap(list[i], list[v.remaining - 1]);
+					break;
+				}
+			}
+			v.remaining--;
+		}
+
+		// New cache is the triangle's vertices followed by the old
+		// contents, it can briefly hold 3 more than kCacheSize
+		for (int i = 0; i < cacheCount; ++i)
+		{
+			const uint32_t index = cache[i];
+			if (index != newCache[0] && index != newCache[1] &&
+				index != newCache[2])
+				newCache[newCount++] = index;
+		}
+
+		for (int i = 0; i < newCount; ++i)
+		{
+			VertexInfo &v = verts[newCache[i]];
+			v.cachePos = i < kCacheSize ? i : -1;
+			v.score = scoreOf(v);
+		}
+
+		// Rescore triangles around the cache and pick the best
+		float bestScore = -1.f;
+		best = -1;
+		for (int i = 0; i < newCount; ++i)
+		{
+			const VertexInfo &v = verts[newCache[i]];
+			for (uint32_t j = 0; j < v.remaining; ++j)
+			{
+				const uint32_t t = vertexTriangles[v.firstTriangle + j];
+				const float score = verts[indices[t * 3 + 0]].score +
+									verts[indices[t * 3 + 1]].score +
+									verts[indices[t * 3 + 2]].score;
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+
+		cacheCount = std::min(newCount, kCacheSize);
+		std::copy(newCache, newCache + cacheCount, cache);
+	}
+
+	indices.swap(result);
+}
+
+void optimizeVertexFetch(MeshData &mesh)
+{
+	constexpr uint32_t kUnused = ~0u;
+
+	std::vector<uint32_t> remap(mesh.vertices.size(), kUnused);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+
+	for (uint32_t &index : mesh.indices)
+	{
+		if (remap[index] == kUnused)
+		{
+			remap[index] = static_cast<uint32_t>(vertices.size());
+			vertices.push_back(mesh.vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	mesh.vertices.swap(vertices);
+}
+
+float computeAcmr(const std::vector<uint32_t> &indices, size_t vertexCount,
+				  uint32_t cacheSize)
+{
+	const size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return 0.f;
+
+	// Time each vertex entered the cache, a vertex is still cached if
+	// fewer than cacheSize misses happened since
+	std::vector<uint64_t> enteredAt(vertexCount, 0);
+	uint64_t misses = 0;
+
+	for (uint32_t index : indices)
+	{
+		if (enteredAt[index] == 0 || misses - enteredAt[index] >= cacheSize)
+			enteredAt[index] = ++misses;
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
+
+std::string cookedMeshPath(const char *sourcePath)
+{
+	return std::filesystem::path(sourcePath).replace_extension(".mesh").string();
+}
+
+bool meshNeedsCooking(const char *sourcePath, const char *cookedPath)
+{
+	std::error_code ec;
+
+	const auto cookedTime = std::filesystem::last_write_time(cookedPath, ec);
+	if (ec)
+		return true;
+
+	// No source (shipped cooked only), use what we have
+	const auto sourceTime = std::filesystem::last_write_time(sourcePath, ec);
+	if (ec)
+		return false;
+
+	return sourceTime > cookedTime;
+}
+
+bool writeCookedMesh(const char *path, const MeshData &mesh)
+{
+	MeshFileHeader header{};
+	header.magic = MeshFileHeader::kMagic;
+	header.version = MeshFileHeader::kVersion;
+	header.vertexSize = sizeof(Vertex);
+	header.indexSize =
+		mesh.vertices.size() <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+	header.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+	header.indexCount = static_cast<uint32_t>(mesh.indices.size());
+	memcpy(header.boundsMin, &mesh.boundsMin, sizeof(header.boundsMin));
+	memcpy(header.boundsMax, &mesh.boundsMax, sizeof(header.boundsMax));
+
+	// Write to a temporary and rename so a crash never leaves a partial
+	// file that looks up to date
+	const std::string tempPath = std::string(path) + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char *>(mesh.vertices.data()),
+				   mesh.vertices.size() * sizeof(Vertex));
+		if (header.indexSize == sizeof(uint16_t))
+		{
+			std::vector<uint16_t> shortIndices(mesh.indices.begin(),
+											   mesh.indices.end());
+			file.write(reinterpret_cast<const char *>(shortIndices.data()),
+					   shortIndices.size() * sizeof(uint16_t));
+		}
+		else
+		{
+			file.write(reinterpret_cast<const char *>(mesh.indices.data()),
+					   mesh.indices.size() * sizeof(uint32_t));
+		}
+
+		if (!file.good())
+			return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tempPath, path, ec);
+	return !ec;
+}
+
+bool CookedMesh::open(const char *path)
+{
+	if (!mFile.open(path))
+		return false;
+
+	if (mFile.size() < sizeof(MeshFileHeader))
+		return false;
+
+	const auto *header = reinterpret_cast<const MeshFileHeader *>(mFile.data());
+	if (header->magic != MeshFileHeader::kMagic ||
+		header->version != MeshFileHeader::kVersion ||
+		header->vertexSize != sizeof(Vertex) ||
+		(header->indexSize != sizeof(uint16_t) &&
+		 header->indexSize != sizeof(uint32_t)))
+	{
+		std::cerr << path << ": unsupported cooked mesh" << std::endl;
+		return false;
+	}
+
+	const size_t expectedSize = sizeof(MeshFileHeader) +
+								size_t(header->vertexCount) * sizeof(Vertex) +
+								size_t(header->indexCount) * header->indexSize;
+	if (mFile.size() < expectedSize)
+	{
+		std::cerr << path << ": truncated cooked mesh" << std::endl;
+		return false;
+	}
+
+	mHeader = header;
+	mVertices = reinterpret_cast<const Vertex *>(mFile.data() +
+												 sizeof(MeshFileHeader));
+	mIndices = mFile.data() + sizeof(MeshFileHeader) +
+			   size_t(header->vertexCount) * sizeof(Vertex);
+	return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+// Mesh in memory, what the importer produces and the cooker writes
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	glm::vec3 boundsMin{0.f};
+	glm::vec3 boundsMax{0.f};
+};
+
+// Cooked mesh file layout, native endianness:
+//   MeshFileHeader
+//   Vertex   vertices[vertexCount]
+//   uint16_t or uint32_t indices[indexCount]
+struct MeshFileHeader
+{
+	static constexpr uint32_t kMagic = 0x4853454d; // "MESH"
+	static constexpr uint32_t kVersion = 2;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexSize; // sizeof(Vertex) when cooked
+	uint32_t indexSize;	 // 2 when every vertex fits in 16 bits, else 4
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+static_assert(sizeof(MeshFileHeader) % alignof(Vertex) == 0,
+			  "vertices must stay aligned after the header");
+
+// Parses an OBJ file (single shape). Throws on failure.
+MeshData importObj(const char *path);
+
+// Reorders triangles so vertices are reused while still in the
+// post-transform cache (Forsyth's linear-speed optimizer)
+void optimizeVertexCache(std::vector<uint32_t> &indices, size_t vertexCount);
+
+// Reorders vertices into first-use order so vertex fetch walks memory
+// forward, and drops vertices no triangle uses
+void optimizeVertexFetch(MeshData &mesh);
+
+// Average cache misses per triangle with a FIFO post-transform cache, 0.5
+// is ideal for large regular meshes and 3 is no reuse at all
+float computeAcmr(const std::vector<uint32_t> &indices, size_t vertexCount,
+				  uint32_t cacheSize = 16);
+
+// Where the cooked version of a source mesh lives, next to it with a
+// .mesh extension
+std::string cookedMeshPath(const char *sourcePath);
+
+// True if the cooked file is missing or older than the source
+bool meshNeedsCooking(const char *sourcePath, const char *cookedPath);
+
+bool writeCookedMesh(const char *path, const MeshData &mesh);
+
+// A cooked mesh mapped into memory, vertices and indices point straight
+// into the file
+class CookedMesh
+{
+  public:
+	// Returns false if the file is missing, truncated or from another
+	// version
+	bool open(const char *path);
+
+	const MeshFileHeader &header() const { return *mHeader; }
+	const Vertex *vertices() const { return mVertices; }
+	const void *indices() const { return mIndices; } // header().indexSize each
+
+  private:
+	MappedFile mFile;
+	const MeshFileHeader *mHeader = nullptr;
+	const Vertex *mVertices = nullptr;
+	const void *mIndices = nullptr;
+};
@@ -0,0 +1,393 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <nlohmann/json.hpp>
+
+#if WITH_EDITOR
+#include "Editor.h"
+
+#include <imgui.h>
+#endif
+
+constexpr size_t kEventsPerThread = 1 << 16;
+constexpr size_t kFrameHistory = 240;
+
+// Oldest slots of each ring readers leave alone, room for the owning
+// thread to keep writing while the rest is copied
+constexpr size_t kReadGuard = 4096;
+
+// Single writer (the owning thread). Readers take a snapshot of the write
+// index, copy, then drop whatever the thread overwrote meanwhile (see
+// lappedEvents).
+struct ThreadEvents
+{
+	uint32_t thread = 0;
+	uint32_t depth = 0;
+	std::atomic<uint64_t> written{0};
+	std::unique_ptr<Profiler::Event[]> events =
+		std::make_unique<Profiler::Event[]>(kEventsPerThread);
+};
+
+struct ProfilerState
+{
+	std::mutex threadsMutex;
+	std::vector<std::unique_ptr<ThreadEvents>> threads; // never shrinks
+
+	uint64_t frameStart = 0;
+
+	std::vector<Profiler::Event> lastFrame;
+	uint64_t lastFrameStart = 0;
+	uint64_t lastFrameEnd = 0;
+
+	std::vector<float> frameTimes;
+	bool paused = false;
+};
+
+static ProfilerState &state()
+{
+	static ProfilerState s;
+	return s;
+}
+
+// How many of the copied events [begin, begin + count) the owning thread
+// may have overwritten while they were read, they are the oldest ones.
+// Event i is overwritten once event i + kEventsPerThread is written.
+static uint64_t lappedEvents(const ThreadEvents &t, uint64_t begin,
+							 uint64_t count)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const uint64_t written = t.written.load(std::memory_order_relaxed);
+	if (written <= begin + kEventsPerThread)
+		return 0;
+
+	return std::min<uint64_t>(written - kEventsPerThread - begin, count);
+}
+
+static ThreadEvents &threadEvents()
+{
+	static thread_local ThreadEvents *events = nullptr;
+	if (!events)
+	{
+		auto &s = state();
+		std::lock_guard<std::mutex> lock(s.threadsMutex);
+		s.threads.push_back(std::make_unique<ThreadEvents>());
+		events = s.threads.back().get();
+		events->thread = static_cast<uint32_t>(s.threads.size() - 1);
+	}
+	return *events;
+}
+
+uint64_t Profiler::now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+Profiler::ScopedZone::ScopedZone(const char *name) : mName(name)
+{
+	++threadEvents().depth;
+	mStart = now();
+}
+
+Profiler::ScopedZone::~ScopedZone()
+{
+	const uint64_t end = now();
+
+	ThreadEvents &t = threadEvents();
+	--t.depth;
+
+	const uint64_t index = t.written.load(std::memory_order_relaxed);
+	t.events[index % kEventsPerThread] = {mName, mStart, end, t.thread,
+										  t.depth};
+	t.written.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::frameMark()
+{
+	auto &s = state();
+
+	const uint64_t frameEnd = now();
+	const uint64_t frameStart = s.frameStart;
+	s.frameStart = frameEnd;
+
+	if (frameStart == 0)
+		return;
+
+	s.frameTimes.push_back(static_cast<float>(frameEnd - frameStart) * 1e-6f);
+	if (s.frameTimes.size() > kFrameHistory)
+		s.frameTimes.erase(s.frameTimes.begin());
+
+	if (s.paused)
+		return;
+
+	s.lastFrame.clear();
+	s.lastFrameStart = frameStart;
+	s.lastFrameEnd = frameEnd;
+
+	std::lock_guard<std::mutex> lock(s.threadsMutex);
+	for (auto &t : s.threads)
+	{
+		const uint64_t written = t->written.load(std::memory_order_acquire);
+		const uint64_t available =
+			std::min<uint64_t>(written, kEventsPerThread - kReadGuard);
+
+		// Events are stored in end order, walk back until we leave the frame
+		const size_t first = s.lastFrame.size();
+		for (uint64_t i = 0; i < available; ++i)
+		{
+			const Event &e = t->events[(written - 1 - i) % kEventsPerThread];
+			if (e.end < frameStart)
+				break;
+			s.lastFrame.push_back(e);
+		}
+
+		// Copied newest first, so lapped events are at the back
+		const uint64_t copied = s.lastFrame.size() - first;
+		const uint64_t lapped = lappedEvents(*t, written - copied, copied);
+		s.lastFrame.resize(s.lastFrame.size() - lapped);
+
+		// Zones that started after the frame ended belong to the next one
+		s.lastFrame.erase(std::remove_if(s.lastFrame.begin() + first,
+										 s.lastFrame.end(),
+										 [frameEnd](const Event &e)
+										 { return e.start >= frameEnd; }),
+						  s.lastFrame.end());
+	}
+
+	std::sort(s.lastFrame.begin(), s.lastFrame.end(),
+			  [](const Event &a, const Event &b)
+			  {
+				  if (a.thread != b.thread)
+					  return a.thread < b.thread;
+				  return a.start < b.start;
+			  });
+}
+
+const std::vector<Profiler::Event> &Profiler::lastFrame()
+{
+	return state().lastFrame;
+}
+
+uint64_t Profiler::lastFrameStart() { return state().lastFrameStart; }
+
+uint64_t Profiler::lastFrameEnd() { return state().lastFrameEnd; }
+
+const std::vector<float> &Profiler::frameTimes() { return state().frameTimes; }
+
+void Profiler::setPaused(bool paused) { state().paused = paused; }
+
+bool Profiler::isPaused() { return state().paused; }
+
+bool Profiler::exportChromeTrace(const char *path)
+{
+	auto &s = state();
+
+	// Copy first so the slow JSON building doesn't widen the window in
+	// which other threads can lap their rings
+	std::vector<Event> copied;
+	{
+		std::lock_guard<std::mutex> lock(s.threadsMutex);
+		for (auto &t : s.threads)
+		{
+			const uint64_t written =
+				t->written.load(std::memory_order_acquire);
+			const uint64_t available = std::min<uint64_t>(
+				written, kEventsPerThread - kReadGuard);
+			const uint64_t begin = written - available;
+
+			const size_t first = copied.size();
+			for (uint64_t i = begin; i < written; ++i)
+				copied.push_back(t->events[i % kEventsPerThread]);
+
+			// Copied oldest first, so lapped events are at the front
+			const uint64_t lapped = lappedEvents(*t, begin, available);
+			copied.erase(copied.begin() + first,
+						 copied.begin() + first + lapped);
+		}
+	}
+
+	nlohmann::json events = nlohmann::json::array();
+	for (const Event &e : copied)
+	{
+		// Complete events, times in microseconds
+		events.push_back(
+			{{"name", e.name},
+			 {"cat", "cpu"},
+			 {"ph", "X"},
+			 {"ts", static_cast<double>(e.start) * 1e-3},
+			 {"dur", static_cast<double>(e.end - e.start) * 1e-3},
+			 {"pid", 0},
+			 {"tid", e.thread}});
+	}
+
+	std::ofstream file(path);
+	if (!file.is_open())
+		return false;
+
+	nlohmann::json trace;
+	trace["traceEvents"] = std::move(events);
+	trace["displayTimeUnit"] = "ms";
+	file << trace.dump();
+
+	return file.good();
+}
+
+#if WITH_EDITOR
+static ImU32 zoneColor(const char *name)
+{
+	// Stable color per zone name
+	uint32_t hash = 2166136261u;
+	for (const char *c = name; *c; ++c)
+		hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+
+	return IM_COL32(80 + (hash & 0x7f), 80 + ((hash >> 8) & 0x7f),
+					80 + ((hash >> 16) & 0x7f), 255);
+}
+
+struct ProfilerTool : public EditorTool
+{
+	ProfilerTool() : EditorTool("Profiler") {}
+
+	void draw() override;
+
+  private:
+	float mZoom = 1.f;
+};
+
+void Profiler::registerEditorTool(Editor &editor)
+{
+	editor.registerTool<ProfilerTool>();
+}
+
+void ProfilerTool::draw()
+{
+	const auto &frameTimes = Profiler::frameTimes();
+
+	// --- Frame times ----------------------------------------------------
+	if (!frameTimes.empty())
+	{
+		float maxTime = 0.f;
+		float sum = 0.f;
+		for (float t : frameTimes)
+		{
+			maxTime = std::max(maxTime, t);
+			sum += t;
+		}
+
+		char overlay[64];
+		std::snprintf(overlay, sizeof(overlay), "avg %.2f ms, max %.2f ms",
+					  sum / frameTimes.size(), maxTime);
+
+		ImGui::PlotLines("##FrameTimes", frameTimes.data(),
+						 static_cast<int>(frameTimes.size()), 0, overlay, 0.f,
+						 std::max(33.3f, maxTime), ImVec2(-1, 60));
+
+		// Distribution in 1ms buckets
+		constexpr int kBuckets = 34;
+		float histogram[kBuckets] = {};
+		for (float t : frameTimes)
+			histogram[std::min(static_cast<int>(t), kBuckets - 1)] += 1.f;
+
+		ImGui::PlotHistogram("##FrameHistogram", histogram, kBuckets, 0,
+							 "frame time (1 ms buckets)", 0.f, FLT_MAX,
+							 ImVec2(-1, 60));
+	}
+
+	// --- Controls -------------------------------------------------------
+	bool paused = Profiler::isPaused();
+	if (ImGui::Checkbox("Pause", &paused))
+		Profiler::setPaused(paused);
+
+	ImGui::SameLine();
+	ImGui::SetNextItemWidth(120.f);
+	ImGui::SliderFloat("Zoom", &mZoom, 1.f, 50.f, "%.1fx",
+					   ImGuiSliderFlags_Logarithmic);
+
+	ImGui::SameLine();
+	if (ImGui::Button("Export Chrome trace"))
+		Profiler::exportChromeTrace("profile.json");
+
+	// --- Timeline of the last frame --------------------------------------
+	const auto &events = Profiler::lastFrame();
+	const uint64_t frameStart = Profiler::lastFrameStart();
+	const uint64_t frameEnd = Profiler::lastFrameEnd();
+	if (events.empty() || frameEnd <= frameStart)
+		return;
+
+	ImGui::Text("Last frame: %.3f ms", (frameEnd - frameStart) * 1e-6);
+
+	ImGui::BeginChild("Timeline", ImVec2(0, 0), ImGuiChildFlags_Borders,
+					  ImGuiWindowFlags_HorizontalScrollbar);
+	{
+		constexpr float rowHeight = 18.f;
+
+		const float width =
+			ImGui::GetContentRegionAvail().x * std::max(1.f, mZoom);
+		const float nsToPx = width / static_cast<float>(frameEnd - frameStart);
+
+		// Lay out one lane per thread, tall enough for its deepest zone
+		uint32_t threadCount = 0;
+		for (const auto &e : events)
+			threadCount = std::max(threadCount, e.thread + 1);
+
+		std::vector<uint32_t> laneDepth(threadCount, 0);
+		for (const auto &e : events)
+			laneDepth[e.thread] = std::max(laneDepth[e.thread], e.depth + 1);
+
+		std::vector<float> laneY(threadCount, 0.f);
+		float totalHeight = 0.f;
+		for (uint32_t t = 0; t < threadCount; ++t)
+		{
+			laneY[t] = totalHeight;
+			if (laneDepth[t] > 0)
+				totalHeight += (laneDepth[t] + 0.5f) * rowHeight;
+		}
+
+		ImDrawList *dl = ImGui::GetWindowDrawList();
+		const ImVec2 origin = ImGui::GetCursorScreenPos();
+		const ImVec2 mouse = ImGui::GetIO().MousePos;
+
+		for (const auto &e : events)
+		{
+			const uint64_t start = std::max(e.start, frameStart);
+			const uint64_t end = std::min(e.end, frameEnd);
+
+			const float x0 = origin.x + (start - frameStart) * nsToPx;
+			const float x1 =
+				std::max(x0 + 1.f, origin.x + (end - frameStart) * nsToPx);
+			const float y0 = origin.y + laneY[e.thread] + e.depth * rowHeight;
+			const float y1 = y0 + rowHeight - 1.f;
+
+			dl->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y1),
+							  zoneColor(e.name));
+
+			if (x1 - x0 > 30.f)
+			{
+				dl->PushClipRect(ImVec2(x0, y0), ImVec2(x1, y1), true);
+				dl->AddText(ImVec2(x0 + 2.f, y0 + 2.f),
+							IM_COL32(255, 255, 255, 255), e.name);
+				dl->PopClipRect();
+			}
+
+			if (ImGui::IsWindowHovered() && mouse.x >= x0 && mouse.x < x1 &&
+				mouse.y >= y0 && mouse.y < y1)
+			{
+				ImGui::SetTooltip("%s\n%.3f ms (thread %u)", e.name,
+								  (e.end - e.start) * 1e-6, e.thread);
+			}
+		}
+
+		ImGui::Dummy(ImVec2(width, totalHeight));
+	}
+	ImGui::EndChild();
+}
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "EngineDefs.h"
+
+#include <cstdint>
+#include <vector>
+
+#if WITH_EDITOR
+class Editor;
+#endif
+
+// Scoped CPU timers. Every thread records into its own ring buffer, the
+// main thread gathers the last frame's zones in frameMark().
+class Profiler
+{
+  public:
+	struct Event
+	{
+		const char *name; // must be a string literal or otherwise static
+		uint64_t start;	  // ns
+		uint64_t end;	  // ns
+		uint32_t thread;  // registration order, main thread is usually 0
+		uint32_t depth;	  // nesting on its thread
+	};
+
+	class ScopedZone
+	{
+	  public:
+		explicit ScopedZone(const char *name);
+		~ScopedZone();
+
+		ScopedZone(const ScopedZone &) = delete;
+		ScopedZone &operator=(const ScopedZone &) = delete;
+
+	  private:
+		const char *mName;
+		uint64_t mStart;
+	};
+
+	static uint64_t now();
+
+	// Call once per frame on the main thread, ends the previous frame
+	static void frameMark();
+
+	// Zones of the last completed frame, sorted by thread then start
+	static const std::vector<Event> &lastFrame();
+	static uint64_t lastFrameStart();
+	static uint64_t lastFrameEnd();
+
+	// Frame times in ms, oldest first
+	static const std::vector<float> &frameTimes();
+
+	// Stops frameMark from replacing lastFrame, so it can be inspected
+	static void setPaused(bool paused);
+	static bool isPaused();
+
+	// Writes what is still in the ring buffers as a Chrome trace
+	// (chrome://tracing, Perfetto). The oldest events of each thread are
+	// skipped, they could be overwritten while being read. Returns false
+	// if the file can't be written.
+	static bool exportChromeTrace(const char *path);
+
+#if WITH_EDITOR
+	// Adds the frame time graph and timeline window to the editor
+	static void registerEditorTool(Editor &editor);
+#endif
+};
+
+#if WITH_PROFILER
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name)                                                    \
+	Profiler::ScopedZone PROFILE_CONCAT(_profileZone, __LINE__)(name)
+#define PROFILE_FRAME() Profiler::frameMark()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FRAME()
+#endif
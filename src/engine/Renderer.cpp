@@ -1,66 +1,397 @@
 #include "Renderer.h"
+#include "AtlasPacker.h"
 #include "Engine.h"
+#include "MeshAsset.h"
+#include "Profiler.h"
+#include "TextureAsset.h"
 
 #include <glad/glad.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#pragma warning(push)
-#pragma warning(disable : 26495)
-#pragma warning(disable : 6262)
-#pragma warning(disable : 6054)
-#define TINYOBJLOADER_IMPLEMENTATION
-#include <tiny_obj_loader.h>
-#pragma warning(pop)
-
 #pragma warning(push)
 #pragma warning(disable : 26451)
 #pragma warning(disable : 26819)
 #pragma warning(disable : 6262)
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 #pragma warning(pop)
 
+// EXT_texture_compression_s3tc, not in every glad build
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
 #include <unordered_map>
 
+#if WITH_EDITOR
+#include <imgui.h>
+#endif
+
 struct GLTexture
 {
 	GLuint id;
 	int width;
 	int height;
+	bool loading; // id is the white placeholder until the upload
+	bool failed;  // decode failed, id stays the placeholder for good
+
+	// Sub-rectangle of id to sample (u0, v0, u1, v1). Atlas textures share
+	// their page's id, only drawQuad and drawUIQuad honour this.
+	glm::vec4 uvRect{0.f, 0.f, 1.f, 1.f};
+	bool inAtlas;
+
+	// Loaded from a file and shared through the cache, 0 for textures
+	// made with createTexture
+	uint32_t refs;
+	std::string path;
+	bool atlasLoad; // cached in atlasTexturesByPath
+};
+
+// Texture being loaded by loadTextureAsync. A worker decodes into pixels,
+// then the renderer uploads it and points target at the new GL texture.
+struct TextureLoad
+{
+	std::string path;
+
+	// Main thread only. Cleared if the texture is deleted while loading.
+	GLTexture *target = nullptr;
+
+	JobCounter decoded;
+
+	bool atlas = false; // pack into an atlas page if small enough
+
+	// Written by the worker, read once decoded is done. Non-atlas loads
+	// open the cooked texture, pixels is only used if there isn't one and
+	// is null if decoding failed too.
+	CookedTexture cooked;
+	unsigned char *pixels = nullptr;
+	int width = 0;
+	int height = 0;
+
+	~TextureLoad()
+	{
+		if (pixels)
+			stbi_image_free(pixels);
+	}
+};
+
+// Atlas pages, and the largest image packed into one. Bigger images get
+// their own texture.
+constexpr int kAtlasPageSize = 2048;
+constexpr int kMaxAtlasImageSize = 256;
+
+// Border around each atlas image, a copy of its edge texels so linear
+// filtering never picks up a neighbour
+constexpr int kAtlasPadding = 1;
+
+struct AtlasPage
+{
+	GLuint texture = 0;
+	AtlasPacker packer{kAtlasPageSize, kAtlasPageSize};
 };
 
+// Bytes of decoded textures uploaded per frame, at least one texture is
+// always uploaded so larger ones still get through
+constexpr size_t kTextureUploadBudget = 8 * 1024 * 1024;
+
 struct GLMesh
 {
 	GLuint vao;
 	GLuint vbo;
 	GLuint ibo;
 	uint32_t indexCount;
+	GLenum indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+
+	// Model space, drawMesh culls against these
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
+	// Same as GLTexture
+	uint32_t refs;
+	std::string path;
 };
 
-struct RendererImpl
+// Per-instance data for batched quads, laid out to match the attributes of
+// the instanced quad shader (locations 3-8).
+struct QuadInstance
 {
-	GLuint cameraUbo = 0;
-	GLuint lightingUbo = 0;
-	GLuint shaderProgram = 0;
+	glm::mat4 model;
+	glm::vec4 color;
+	glm::vec4 uvRect;
+};
 
-	GLuint whiteTexture = 0;
+// CPU side info used to sort queued quads into batches. Not uploaded.
+struct QuadBatchKey
+{
+	GLuint texture;
+	bool translucent;
+	uint32_t order; // submission order, keeps sorting stable
+};
 
-	GLuint quadVao = 0;
-	GLuint quadVbo = 0;
+constexpr int kMaxTextureUnits = 8;
 
-	// mesh cache
-	std::unordered_map<int64_t, GLMesh> meshes;
-	int64_t nextMeshId = 1;
+struct UIVertex
+{
+	glm::vec2 pos; // screen position
+	glm::vec2 uv;
+	glm::vec4 color;
+	uint32_t texIndex; // slot into the textures bound for the batch
+};
 
-	// UI
-	GLuint uiShader = 0;
-	GLuint uiVao = 0;
-	GLuint uiVbo = 0;
+// Max UI textures per draw. Must match the uTextures size in the UI shader
+constexpr uint32_t kUITextureSlots = 8;
 
-	glm::mat4 uiProj;
+// Bytes of streamed data (uniforms, instances, vertices) a frame can use
+constexpr size_t kFrameDataSize = 32 * 1024 * 1024;
+
+// Vertex buffer binding index the quad instance data is attached to. Kept
+// clear of the bindings glVertexAttribPointer uses implicitly for 0-2.
+constexpr GLuint kQuadInstanceBinding = 8;
+
+// Max UI quads per draw, keeps indices within 16 bits
+constexpr uint32_t kMaxUIQuads = 65536 / 4;
+
+// Run of quads in a UIQuadList drawn together, texIndex of each vertex is
+// a slot into textures. All quads in a batch share a clip rect.
+struct UIQuadBatch
+{
+	uint32_t firstQuad;
+	uint32_t quadCount;
+	GLuint textures[kUITextureSlots];
+	uint32_t textureCount;
+	uint32_t clip;
+};
+
+struct GLUIQuadList
+{
+	GLuint vbo = 0;
+	uint32_t capacity = 0; // in quads
+
+	// CPU copy of the buffer, and the texture of each quad (nullptr for
+	// the white texture)
+	std::vector<UIVertex> vertices;
+	std::vector<const GLTexture *> textures;
+
+	// Clip rect index of each quad, 0 = unclipped
+	std::vector<uint32_t> clips;
+	std::vector<glm::vec4> clipRects;
+
+	// Sorted by firstQuad. Rebuilt on the next draw when a quad's texture
+	// doesn't fit its batch.
+	std::vector<UIQuadBatch> batches;
+	bool rebatch = true;
+
+	// Quads to upload on the next draw
+	uint32_t dirtyBegin = UINT32_MAX;
+	uint32_t dirtyEnd = 0;
+
+	// Quads written while their texture was still loading, rewritten with
+	// the real texture and UVs once it's uploaded
+	std::vector<uint32_t> loadingQuads;
+};
+
+// Uniforms the renderer knows about. Locations are resolved once at link
+// time so the draw path never does a string lookup.
+enum class Uniform
+{
+	Model,
+	Texture,
+	Color,
+	MVP,
+	Textures,
+	Count
+};
+
+static const char *kUniformNames[] = {"model", "uTexture", "uColor", "uMVP",
+									  "uTextures"};
+static_assert(std::size(kUniformNames) ==
+			  static_cast<size_t>(Uniform::Count));
+
+struct GLProgram
+{
+	GLuint id = 0;
+	GLint locations[static_cast<size_t>(Uniform::Count)];
+
+	bool create(const char *vs, const char *fs)
+	{
+		GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex, 1, &vs, nullptr);
+		glCompileShader(vertex);
+
+		GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fragment, 1, &fs, nullptr);
+		glCompileShader(fragment);
+
+		id = glCreateProgram();
+		glAttachShader(id, vertex);
+		glAttachShader(id, fragment);
+		glLinkProgram(id);
+
+		glDeleteShader(vertex);
+		glDeleteShader(fragment);
+
+		GLint linked = GL_FALSE;
+		glGetProgramiv(id, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			char log[1024];
+			glGetProgramInfoLog(id, sizeof(log), nullptr, log);
+			std::cerr << "Shader link failed: " << log << std::endl;
+			return false;
+		}
+
+		for (size_t i = 0; i < std::size(kUniformNames); ++i)
+			locations[i] = glGetUniformLocation(id, kUniformNames[i]);
+
+		// Uniform blocks have fixed bindings, the same for every program
+		GLuint cameraBlockIndex = glGetUniformBlockIndex(id, "Camera");
+		if (cameraBlockIndex != GL_INVALID_INDEX)
+			glUniformBlockBinding(id, cameraBlockIndex, 0);
+
+		GLuint lightingBlockIndex = glGetUniformBlockIndex(id, "Lighting");
+		if (lightingBlockIndex != GL_INVALID_INDEX)
+			glUniformBlockBinding(id, lightingBlockIndex, 1);
+
+		// Samplers always read from unit 0, sampler arrays from units 0..n
+		set(Uniform::Texture, 0);
+
+		GLint textureCount = 0;
+		GLuint texturesIndex = glGetProgramResourceIndex(
+			id, GL_UNIFORM, "uTextures[0]");
+		if (texturesIndex != GL_INVALID_INDEX)
+		{
+			const GLenum prop = GL_ARRAY_SIZE;
+			glGetProgramResourceiv(id, GL_UNIFORM, texturesIndex, 1, &prop, 1,
+								   nullptr, &textureCount);
+		}
+
+		int units[kMaxTextureUnits];
+		for (int i = 0; i < kMaxTextureUnits; ++i)
+			units[i] = i;
+		set(Uniform::Textures, units,
+			std::min(textureCount, kMaxTextureUnits));
+
+		return true;
+	}
+
+	void destroy()
+	{
+		if (id != 0)
+		{
+			glDeleteProgram(id);
+			id = 0;
+		}
+	}
+
+	GLint location(Uniform uniform) const
+	{
+		return locations[static_cast<size_t>(uniform)];
+	}
+
+	// Setters use glProgramUniform so the program doesn't need to be bound
+	void set(Uniform uniform, int value) const
+	{
+		GLint loc = location(uniform);
+		if (loc >= 0)
+			glProgramUniform1i(id, loc, value);
+	}
+
+	void set(Uniform uniform, const int *values, int count) const
+	{
+		GLint loc = location(uniform);
+		if (loc >= 0)
+			glProgramUniform1iv(id, loc, count, values);
+	}
+
+	void set(Uniform uniform, const glm::vec4 &value) const
+	{
+		GLint loc = location(uniform);
+		if (loc >= 0)
+			glProgramUniform4fv(id, loc, 1, glm::value_ptr(value));
+	}
+
+	void set(Uniform uniform, const glm::mat4 &value) const
+	{
+		GLint loc = location(uniform);
+		if (loc >= 0)
+			glProgramUniformMatrix4fv(id, loc, 1, GL_FALSE,
+									  glm::value_ptr(value));
+	}
+};
+
+// Shadows the bits of GL binding state the renderer touches every draw, so
+// redundant binds are skipped. Anything that binds behind its back (ImGui)
+// must be followed by invalidate().
+struct GLStateCache
+{
+	static constexpr int kTextureUnits = kMaxTextureUnits;
+
+	GLuint program = 0;
+	GLuint vertexArray = 0;
+	GLuint textures[kTextureUnits] = {};
+	GLenum activeUnit = 0;
+
+	void invalidate()
+	{
+		// Use values no real object can have so the next bind goes through
+		program = ~0u;
+		vertexArray = ~0u;
+		for (auto &texture : textures)
+			texture = ~0u;
+		activeUnit = ~0u;
+	}
+
+	void useProgram(GLuint id)
+	{
+		if (program != id)
+		{
+			glUseProgram(id);
+			program = id;
+		}
+	}
+
+	void bindVertexArray(GLuint id)
+	{
+		if (vertexArray != id)
+		{
+			glBindVertexArray(id);
+			vertexArray = id;
+		}
+	}
+
+	void bindTexture(GLenum unit, GLuint id)
+	{
+		assert(unit < kTextureUnits);
+
+		if (textures[unit] == id)
+			return;
+
+		if (activeUnit != unit)
+		{
+			glActiveTexture(GL_TEXTURE0 + unit);
+			activeUnit = unit;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, id);
+		textures[unit] = id;
+	}
 };
 
 struct alignas(16) CameraData
@@ -81,42 +412,393 @@ struct alignas(16) LightingData
 	float _pad2;
 };
 
-struct Vertex
+// Persistently mapped buffer split into one region per frame in flight.
+// Per-frame data (uniforms, streamed vertices) is sub-allocated from the
+// current region and written straight into the mapping. A fence per region
+// makes sure the GPU is done reading it before the CPU writes it again.
+struct GLRingBuffer
 {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 uv;
+	static constexpr uint32_t kFramesInFlight = 3;
+
+	struct Allocation
+	{
+		void *data = nullptr; // nullptr if the region is out of space
+		GLintptr offset = 0;  // offset from the start of the buffer
+	};
+
+	GLuint buffer = 0;
+	uint8_t *mapped = nullptr;
+	size_t regionSize = 0;
+
+	uint32_t region = 0;
+	size_t head = 0; // offset into the current region
+	GLsync fences[kFramesInFlight] = {};
+
+	bool create(size_t _regionSize)
+	{
+		regionSize = _regionSize;
+
+		const GLbitfield flags =
+			GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, regionSize * kFramesInFlight, nullptr,
+							 flags);
+		mapped = static_cast<uint8_t *>(glMapNamedBufferRange(
+			buffer, 0, regionSize * kFramesInFlight, flags));
+
+		// allocate() then always fails instead of handing out offsets
+		// into nothing
+		if (!mapped)
+			regionSize = 0;
+
+		return mapped != nullptr;
+	}
+
+	void destroy()
+	{
+		for (auto &fence : fences)
+		{
+			if (fence)
+			{
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+
+		if (buffer != 0)
+		{
+			glUnmapNamedBuffer(buffer);
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+			mapped = nullptr;
+		}
+	}
+
+	// Fences the region used last frame and moves on to the next one,
+	// waiting if the GPU is still reading it from kFramesInFlight ago
+	void nextFrame()
+	{
+		if (fences[region])
+			glDeleteSync(fences[region]);
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		region = (region + 1) % kFramesInFlight;
+		head = 0;
+
+		if (GLsync fence = fences[region])
+		{
+			GLenum result;
+			do
+			{
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+										  1'000'000); // 1ms
+			} while (result == GL_TIMEOUT_EXPIRED);
+
+			glDeleteSync(fence);
+			fences[region] = nullptr;
+		}
+	}
+
+	Allocation allocate(size_t size, size_t alignment)
+	{
+		size_t start = (head + alignment - 1) & ~(alignment - 1);
+		if (start + size > regionSize)
+			return {};
+
+		head = start + size;
+
+		size_t offset = region * regionSize + start;
+		return {mapped + offset, static_cast<GLintptr>(offset)};
+	}
 };
 
-struct UIVertex
+// Two GL_TIME_ELAPSED queries used alternately. Results are read once the
+// driver says they are available, if both are still in flight the pass
+// goes untimed that frame instead of stalling.
+struct GLPassTimer
 {
-	glm::vec2 pos; // local quad position
-	glm::vec2 uv;
+	GLuint queries[2] = {};
+	bool pending[2] = {};
+	uint32_t next = 0;
+	bool active = false;
+
+	float ms = 0.f; // newest result
+
+	void create() { glGenQueries(2, queries); }
+
+	void destroy()
+	{
+		glDeleteQueries(2, queries);
+		queries[0] = queries[1] = 0;
+		pending[0] = pending[1] = false;
+	}
+
+	void poll()
+	{
+		// Oldest first so the newer result wins
+		for (uint32_t i = 0; i < 2; ++i)
+		{
+			const uint32_t q = (next + i) % 2;
+			if (!pending[q])
+				continue;
+
+			GLint available = 0;
+			glGetQueryObjectiv(queries[q], GL_QUERY_RESULT_AVAILABLE,
+							   &available);
+			if (!available)
+				continue;
+
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &ns);
+			ms = static_cast<float>(ns) * 1e-6f;
+			pending[q] = false;
+		}
+	}
+
+	void begin()
+	{
+		poll();
+		if (pending[next])
+			return;
+
+		glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+		active = true;
+	}
+
+	void end()
+	{
+		if (!active)
+			return;
+
+		glEndQuery(GL_TIME_ELAPSED);
+		pending[next] = true;
+		next = (next + 1) % 2;
+		active = false;
+	}
+};
+
+constexpr size_t kRenderPassCount = static_cast<size_t>(RenderPass::Count);
+
+struct RendererImpl
+{
+	GLProgram meshProgram;
+
+	// Per-frame dynamic data: camera/lighting uniforms, quad instances and
+	// UI vertices
+	GLRingBuffer frameData;
+	size_t uniformAlignment = 256;
+	bool warnedFrameDataFull = false;
+
+	// Lighting is kept on the CPU and uploaded every frame, it is not set
+	// on frames without a world update
+	LightingData lighting{};
+	bool inFrame = false;
+
+	GLStateCache state;
+
+	GLuint whiteTexture = 0;
+
+	// Async texture loads, oldest first
+	std::vector<std::shared_ptr<TextureLoad>> textureLoads;
+
+	std::vector<AtlasPage> atlasPages;
+
+	GLuint quadVao = 0;
+	GLuint quadVbo = 0;
+
+	// Quad batching. drawQuad only queues, flushQuads issues the draws.
+	GLProgram quadProgram;
+
+	std::vector<QuadInstance> quadInstances;
+	std::vector<QuadBatchKey> quadKeys;
+
+	// scratch for flushQuads
+	std::vector<uint32_t> quadSortOrder;
+
+	// Instances that don't fit in frameData go through this instead. It
+	// grows to fit and is orphaned on every use.
+	GLuint quadOverflowVbo = 0;
+	size_t quadOverflowCapacity = 0;
+	std::vector<QuadInstance> quadOverflow;
+
+	// mesh cache
+	std::unordered_map<int64_t, GLMesh> meshes;
+	int64_t nextMeshId = 1;
+
+	// Loaded resources by path, each path is loaded once and shared. An
+	// image loaded into the atlas is a different texture from the same
+	// image loaded standalone, so atlas loads are cached apart.
+	std::unordered_map<std::string, GLTexture *> texturesByPath;
+	std::unordered_map<std::string, GLTexture *> atlasTexturesByPath;
+	std::unordered_map<std::string, int64_t> meshesByPath;
+
+	// UI. drawUIQuad appends to uiVertices, flushUI draws everything queued
+	// with up to kUITextureSlots textures bound at once.
+	GLProgram uiProgram;
+	GLuint uiVao = 0;
+	GLuint uiIbo = 0;
+
+	std::vector<UIVertex> uiVertices;
+	GLuint uiTextures[kUITextureSlots] = {};
+	uint32_t uiTextureCount = 0;
+
+	std::unordered_map<int64_t, GLUIQuadList> uiQuadLists;
+	int64_t nextUIQuadListId = 1;
+
+	glm::mat4 uiProj;
+
+	// Maps begin2D units to framebuffer pixels for scissoring
+	glm::vec2 uiScale{1.f};
+	GLint uiViewport[4] = {};
+
+	// Per-pass stats. passCounts accumulates this frame, passStats is the
+	// last complete frame.
+	GLPassTimer passTimers[kRenderPassCount];
+	RenderPassStats passCounts[kRenderPassCount];
+	RenderPassStats passStats[kRenderPassCount];
+	int currentPass = -1;
+
+	Frustum frustum;
+	CullStats cullCounts; // this frame
+	CullStats cullStats;  // last complete frame
+
+	// Headless runs render here instead of the window's framebuffer
+	GLuint offscreenFbo = 0;
+	GLuint offscreenColor = 0;
+	GLuint offscreenDepth = 0;
+	int offscreenWidth = 0;
+	int offscreenHeight = 0;
+
+	void countDraw(uint64_t triangles)
+	{
+		if (currentPass < 0)
+			return;
+
+		passCounts[currentPass].drawCalls++;
+		passCounts[currentPass].triangles += triangles;
+	}
+};
+
+#if WITH_EDITOR
+constexpr size_t kGpuTimeHistory = 240;
+
+// GPU time, draw calls and triangles per render pass
+class RenderStatsTool : public EditorTool
+{
+  public:
+	RenderStatsTool(Renderer *renderer)
+		: EditorTool("Render Stats"), mRenderer(renderer)
+	{
+	}
+
+	void draw() override;
+
+  private:
+	Renderer *mRenderer;
+
+	// Per pass, oldest first
+	std::vector<float> mGpuMs[static_cast<size_t>(RenderPass::Count)];
 };
 
+void RenderStatsTool::draw()
+{
+	static const char *passNames[] = {"Scene", "UI", "Editor"};
+	static_assert(std::size(passNames) ==
+					  static_cast<size_t>(RenderPass::Count),
+				  "one name per pass");
+
+	RenderPassStats total;
+
+	if (ImGui::BeginTable("Passes", 4,
+						  ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+	{
+		ImGui::TableSetupColumn("Pass");
+		ImGui::TableSetupColumn("GPU ms");
+		ImGui::TableSetupColumn("Draw calls");
+		ImGui::TableSetupColumn("Triangles");
+		ImGui::TableHeadersRow();
+
+		for (size_t i = 0; i < std::size(passNames); ++i)
+		{
+			const RenderPassStats stats =
+				mRenderer->passStats(static_cast<RenderPass>(i));
+
+			mGpuMs[i].push_back(stats.gpuMs);
+			if (mGpuMs[i].size() > kGpuTimeHistory)
+				mGpuMs[i].erase(mGpuMs[i].begin());
+
+			total.gpuMs += stats.gpuMs;
+			total.drawCalls += stats.drawCalls;
+			total.triangles += stats.triangles;
+
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::TextUnformatted(passNames[i]);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", stats.gpuMs);
+			ImGui::TableNextColumn();
+			ImGui::Text("%u", stats.drawCalls);
+			ImGui::TableNextColumn();
+			ImGui::Text("%llu",
+						static_cast<unsigned long long>(stats.triangles));
+		}
+
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::TextUnformatted("Total");
+		ImGui::TableNextColumn();
+		ImGui::Text("%.3f", total.gpuMs);
+		ImGui::TableNextColumn();
+		ImGui::Text("%u", total.drawCalls);
+		ImGui::TableNextColumn();
+		ImGui::Text("%llu", static_cast<unsigned long long>(total.triangles));
+
+		ImGui::EndTable();
+	}
+
+	const CullStats cull = mRenderer->cullStats();
+	ImGui::Text("Frustum culling: %u drawn, %u culled", cull.drawn,
+				cull.culled);
+
+	for (size_t i = 0; i < std::size(passNames); ++i)
+	{
+		const auto &history = mGpuMs[i];
+
+		float maxMs = 1.f;
+		for (float ms : history)
+			maxMs = std::max(maxMs, ms);
+
+		char overlay[32];
+		std::snprintf(overlay, sizeof(overlay), "%s GPU ms", passNames[i]);
+
+		ImGui::PlotLines(passNames[i], history.data(),
+						 static_cast<int>(history.size()), 0, overlay, 0.f,
+						 maxMs, ImVec2(-80, 50));
+	}
+}
+#endif
+
 Renderer::Renderer() { mRendererImpl = new RendererImpl(); }
 
 Renderer::~Renderer() { delete mRendererImpl; }
 
 bool Renderer::init()
 {
-	// --- Camera UBO -----------------------------------------------------
-	glGenBuffers(1, &mRendererImpl->cameraUbo);
-	glBindBuffer(GL_UNIFORM_BUFFER, mRendererImpl->cameraUbo);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraData), nullptr,
-				 GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	// --- Per-frame data ------------------------------------------------
+	GLint uniformAlignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	mRendererImpl->uniformAlignment =
+		std::max<size_t>(16, static_cast<size_t>(uniformAlignment));
 
-	glBindBufferBase(GL_UNIFORM_BUFFER, 0, mRendererImpl->cameraUbo);
-
-	// Lighting ubo
-	glGenBuffers(1, &mRendererImpl->lightingUbo);
-	glBindBuffer(GL_UNIFORM_BUFFER, mRendererImpl->lightingUbo);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightingData), nullptr,
-				 GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	if (!mRendererImpl->frameData.create(kFrameDataSize))
+	{
+		std::cerr << "Failed to map per-frame buffer" << std::endl;
+		return false;
+	}
 
-	glBindBufferBase(GL_UNIFORM_BUFFER, 1, mRendererImpl->lightingUbo);
+	for (auto &timer : mRendererImpl->passTimers)
+		timer.create();
 
 	// --- Shader ---------------------------------------------------------
 	const char *vs = R"(
@@ -190,36 +872,90 @@ bool Renderer::init()
         }
     )";
 
-	GLuint vertex = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex, 1, &vs, nullptr);
-	glCompileShader(vertex);
-
-	GLuint fragment = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment, 1, &fs, nullptr);
-	glCompileShader(fragment);
+	mRendererImpl->meshProgram.create(vs, fs);
 
-	mRendererImpl->shaderProgram = glCreateProgram();
-	glAttachShader(mRendererImpl->shaderProgram, vertex);
-	glAttachShader(mRendererImpl->shaderProgram, fragment);
-	glLinkProgram(mRendererImpl->shaderProgram);
-
-	glDeleteShader(vertex);
-	glDeleteShader(fragment);
+	// --- Instanced quad shader -------------------------------------------
+	// Same lighting as the mesh shader, but model matrix and color come from
+	// per-instance attributes so a whole batch is one draw.
+	const char *quadVs = R"(
+        #version 460 core
+        layout (location = 0) in vec3 aPos;
+        layout (location = 1) in vec3 aNormal;
+        layout (location = 2) in vec2 aTexCoords;
+        layout (location = 3) in mat4 aModel; // takes locations 3-6
+        layout (location = 7) in vec4 aColor;
+        layout (location = 8) in vec4 aUVRect;
 
-	// Set camera UBO
-	GLuint cameraBlockIndex =
-		glGetUniformBlockIndex(mRendererImpl->shaderProgram, "Camera");
-	glUniformBlockBinding(mRendererImpl->shaderProgram, cameraBlockIndex, 0);
-	GLuint lightingBlockIndex =
-		glGetUniformBlockIndex(mRendererImpl->shaderProgram, "Lighting");
-	glUniformBlockBinding(mRendererImpl->shaderProgram, lightingBlockIndex, 1);
+		layout(std140, binding = 0) uniform Camera
+		{
+			mat4 uView;
+			mat4 uProj;
+			vec3 uCameraPos;
+			float _pad0;
+		};
 
-	// --- Quad Geometry ---------------------------------------------------
-	// clang-format off
-	std::vector<Vertex> quadVertices = {
-		// pos				      // normal		         // uv
-		{{-0.5f, -0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {0.0f, 0.0f}},
-		{{ 0.5f, -0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {1.0f, 0.0f}},
+		layout(std140, binding = 1) uniform Lighting
+		{
+			vec3 lightPos;
+			float _pad1;
+			vec3 lightColor;
+			float _pad2;
+			vec3 ambient;
+			float _pad3;
+		};
+
+        out vec2 texCoords;
+		out vec4 vertexColor;
+
+        void main()
+        {
+			vec3 worldPos = vec3(aModel * vec4(aPos, 1.0));
+
+			mat3 normalMatrix = transpose(inverse(mat3(aModel)));
+			vec3 norm = normalize(normalMatrix * aNormal);
+
+			vec3 lightDir = normalize(lightPos - worldPos);
+			float diff = max(dot(norm, lightDir), 0.0);
+
+			vec3 diffuse = diff * lightColor;
+
+            vertexColor = vec4(diffuse + ambient, 1.0) * aColor;
+
+			texCoords = mix(aUVRect.xy, aUVRect.zw, aTexCoords);
+
+            gl_Position = uProj * uView * vec4(worldPos, 1.0);
+        }
+    )";
+
+	const char *quadFs = R"(
+        #version 460 core
+
+        in vec2 texCoords;
+        in vec4 vertexColor;
+
+		uniform sampler2D uTexture;
+
+        out vec4 FragColor;
+
+        void main()
+        {
+			vec4 texColor = texture(uTexture, texCoords);
+
+			if (texColor.a < 0.5)
+				discard;
+
+            FragColor = texColor * vertexColor;
+        }
+    )";
+
+	mRendererImpl->quadProgram.create(quadVs, quadFs);
+
+	// --- Quad Geometry ---------------------------------------------------
+	// clang-format off
+	std::vector<Vertex> quadVertices = {
+		// pos				      // normal		         // uv
+		{{-0.5f, -0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {0.0f, 0.0f}},
+		{{ 0.5f, -0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {1.0f, 0.0f}},
 		{{ 0.5f,  0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {1.0f, 1.0f}},
 		{{-0.5f, -0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {0.0f, 0.0f}},
 		{{ 0.5f,  0.5f, 0.0f},    {0.0f, 0.0f, 1.0f},    {1.0f, 1.0f}},
@@ -248,6 +984,30 @@ bool Renderer::init()
 	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
 						  (void *)offsetof(Vertex, uv));
 
+	// Per-instance attributes. The data lives in the per-frame ring buffer,
+	// flushQuads points kQuadInstanceBinding at this frame's allocation.
+	for (GLuint i = 0; i < 4; ++i)
+	{
+		glEnableVertexAttribArray(3 + i);
+		glVertexAttribFormat(
+			3 + i, 4, GL_FLOAT, GL_FALSE,
+			static_cast<GLuint>(offsetof(QuadInstance, model) +
+								sizeof(glm::vec4) * i));
+		glVertexAttribBinding(3 + i, kQuadInstanceBinding);
+	}
+
+	glEnableVertexAttribArray(7);
+	glVertexAttribFormat(7, 4, GL_FLOAT, GL_FALSE,
+						 offsetof(QuadInstance, color));
+	glVertexAttribBinding(7, kQuadInstanceBinding);
+
+	glEnableVertexAttribArray(8);
+	glVertexAttribFormat(8, 4, GL_FLOAT, GL_FALSE,
+						 offsetof(QuadInstance, uvRect));
+	glVertexAttribBinding(8, kQuadInstanceBinding);
+
+	glVertexBindingDivisor(kQuadInstanceBinding, 1);
+
 	glBindVertexArray(0);
 
 	// White texture to use for shaders if a texture is not specified
@@ -266,82 +1026,110 @@ bool Renderer::init()
 
         layout (location = 0) in vec2 aPos;
 		layout (location = 1) in vec2 aUV;
+		layout (location = 2) in vec4 aColor;
+		layout (location = 3) in uint aTexIndex;
 
 		uniform mat4 uMVP;
 
 		out vec2 vUV;
+		out vec4 vColor;
+		flat out uint vTexIndex;
 
         void main()
         {
 			vUV = aUV;
+			vColor = aColor;
+			vTexIndex = aTexIndex;
 			gl_Position = uMVP * vec4(aPos, 0.0, 1.0);
         }
     )";
 
+	// Sampler arrays can only be indexed with dynamically uniform values,
+	// so each slot gets its own branch with a constant index.
 	const char *uiFragSrc = R"(
         #version 460 core
 
 		in vec2 vUV;
+		in vec4 vColor;
+		flat in uint vTexIndex;
 
-		uniform sampler2D uTexture;
-		uniform vec4 uColor;
+		uniform sampler2D uTextures[8];
 
 		out vec4 FragColor;
 
+		vec4 sampleTexture()
+		{
+			switch (vTexIndex)
+			{
+			case 0u: return texture(uTextures[0], vUV);
+			case 1u: return texture(uTextures[1], vUV);
+			case 2u: return texture(uTextures[2], vUV);
+			case 3u: return texture(uTextures[3], vUV);
+			case 4u: return texture(uTextures[4], vUV);
+			case 5u: return texture(uTextures[5], vUV);
+			case 6u: return texture(uTextures[6], vUV);
+			default: return texture(uTextures[7], vUV);
+			}
+		}
+
 		void main()
 		{
-			vec4 tex = texture(uTexture, vUV);
-			FragColor = tex * uColor;
+			FragColor = sampleTexture() * vColor;
 		}
     )";
 
-	GLuint uiVertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(uiVertexShader, 1, &uiVertexSrc, nullptr);
-	glCompileShader(uiVertexShader);
-
-	GLuint uiFragShader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(uiFragShader, 1, &uiFragSrc, nullptr);
-	glCompileShader(uiFragShader);
+	mRendererImpl->uiProgram.create(uiVertexSrc, uiFragSrc);
 
-	mRendererImpl->uiShader = glCreateProgram();
-	glAttachShader(mRendererImpl->uiShader, uiVertexShader);
-	glAttachShader(mRendererImpl->uiShader, uiFragShader);
-	glLinkProgram(mRendererImpl->uiShader);
-
-	glDeleteShader(uiVertexShader);
-	glDeleteShader(uiFragShader);
-
-	// clang-format off
-	std::vector<UIVertex> uiQuad = {
-		{{0, 0}, {0, 1}},
-		{{1, 0}, {1, 1}},
-		{{1, 1}, {1, 0}},
-
-		{{0, 0}, {0, 1}},
-		{{1, 1}, {1, 0}},
-		{{0, 1}, {0, 0}},
-	};
-	// clang-format on
+	// Quads are always 4 vertices with the same index pattern, so the index
+	// buffer is static.
+	std::vector<uint16_t> uiIndices(kMaxUIQuads * 6);
+	for (uint32_t i = 0; i < kMaxUIQuads; ++i)
+	{
+		const uint16_t base = static_cast<uint16_t>(i * 4);
+		uiIndices[i * 6 + 0] = base + 0;
+		uiIndices[i * 6 + 1] = base + 1;
+		uiIndices[i * 6 + 2] = base + 2;
+		uiIndices[i * 6 + 3] = base + 0;
+		uiIndices[i * 6 + 4] = base + 2;
+		uiIndices[i * 6 + 5] = base + 3;
+	}
 
-	glGenBuffers(1, &mRendererImpl->uiVbo);
+	glGenBuffers(1, &mRendererImpl->uiIbo);
 
 	glGenVertexArrays(1, &mRendererImpl->uiVao);
 	glBindVertexArray(mRendererImpl->uiVao);
 
-	glBindBuffer(GL_ARRAY_BUFFER, mRendererImpl->uiVbo);
-	glBufferData(GL_ARRAY_BUFFER, uiQuad.size() * sizeof(UIVertex),
-				 uiQuad.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mRendererImpl->uiIbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, uiIndices.size() * sizeof(uint16_t),
+				 uiIndices.data(), GL_STATIC_DRAW);
 
+	// Vertices are streamed from the per-frame ring buffer, flushUI points
+	// binding 0 at this frame's allocation
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(UIVertex),
-						  (void *)offsetof(UIVertex, pos));
+	glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE, offsetof(UIVertex, pos));
+	glVertexAttribBinding(0, 0);
 
 	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(UIVertex),
-						  (void *)offsetof(UIVertex, uv));
+	glVertexAttribFormat(1, 2, GL_FLOAT, GL_FALSE, offsetof(UIVertex, uv));
+	glVertexAttribBinding(1, 0);
+
+	glEnableVertexAttribArray(2);
+	glVertexAttribFormat(2, 4, GL_FLOAT, GL_FALSE, offsetof(UIVertex, color));
+	glVertexAttribBinding(2, 0);
+
+	glEnableVertexAttribArray(3);
+	glVertexAttribIFormat(3, 1, GL_UNSIGNED_INT, offsetof(UIVertex, texIndex));
+	glVertexAttribBinding(3, 0);
 
 	glBindVertexArray(0);
 
+	// Setup above bound things directly
+	mRendererImpl->state.invalidate();
+
+#if WITH_EDITOR
+	Engine::instance->editor->registerTool<RenderStatsTool>(this);
+#endif
+
 	return true;
 }
 
@@ -354,19 +1142,25 @@ void Renderer::shutdown() noexcept
 		glDeleteBuffers(1, &mesh.vbo);
 		glDeleteBuffers(1, &mesh.ibo);
 	}
+	mRendererImpl->meshes.clear();
+	mRendererImpl->meshesByPath.clear();
 
 	glDeleteVertexArrays(1, &mRendererImpl->quadVao);
 
+	for (auto &page : mRendererImpl->atlasPages)
+		glDeleteTextures(1, &page.texture);
+	mRendererImpl->atlasPages.clear();
+
 	if (mRendererImpl->whiteTexture != 0)
 	{
 		glDeleteTextures(1, &mRendererImpl->whiteTexture);
 		mRendererImpl->whiteTexture = 0;
 	}
 
-	if (mRendererImpl->uiVbo != 0)
+	if (mRendererImpl->uiIbo != 0)
 	{
-		glDeleteBuffers(1, &mRendererImpl->uiVbo);
-		mRendererImpl->uiVbo = 0;
+		glDeleteBuffers(1, &mRendererImpl->uiIbo);
+		mRendererImpl->uiIbo = 0;
 	}
 
 	if (mRendererImpl->uiVao != 0)
@@ -375,11 +1169,11 @@ void Renderer::shutdown() noexcept
 		mRendererImpl->uiVao = 0;
 	}
 
-	if (mRendererImpl->uiShader != 0)
-	{
-		glDeleteProgram(mRendererImpl->uiShader);
-		mRendererImpl->uiShader = 0;
-	}
+	for (auto &[id, list] : mRendererImpl->uiQuadLists)
+		glDeleteBuffers(1, &list.vbo);
+	mRendererImpl->uiQuadLists.clear();
+
+	mRendererImpl->uiProgram.destroy();
 
 	if (mRendererImpl->quadVbo != 0)
 	{
@@ -387,30 +1181,37 @@ void Renderer::shutdown() noexcept
 		mRendererImpl->quadVbo = 0;
 	}
 
-	if (mRendererImpl->shaderProgram != 0)
+	if (mRendererImpl->quadOverflowVbo != 0)
 	{
-		glDeleteProgram(mRendererImpl->shaderProgram);
-		mRendererImpl->shaderProgram = 0;
+		glDeleteBuffers(1, &mRendererImpl->quadOverflowVbo);
+		mRendererImpl->quadOverflowVbo = 0;
+		mRendererImpl->quadOverflowCapacity = 0;
 	}
 
-	if (mRendererImpl->lightingUbo != 0)
-	{
-		glDeleteBuffers(1, &mRendererImpl->lightingUbo);
-		mRendererImpl->lightingUbo = 0;
-	}
+	mRendererImpl->quadProgram.destroy();
+	mRendererImpl->meshProgram.destroy();
 
-	if (mRendererImpl->cameraUbo != 0)
+	mRendererImpl->frameData.destroy();
+
+	if (mRendererImpl->offscreenFbo != 0)
 	{
-		glDeleteBuffers(1, &mRendererImpl->cameraUbo);
-		mRendererImpl->cameraUbo = 0;
+		glDeleteFramebuffers(1, &mRendererImpl->offscreenFbo);
+		glDeleteRenderbuffers(1, &mRendererImpl->offscreenColor);
+		glDeleteRenderbuffers(1, &mRendererImpl->offscreenDepth);
+		mRendererImpl->offscreenFbo = 0;
 	}
+
+	for (auto &timer : mRendererImpl->passTimers)
+		timer.destroy();
+
+	mRendererImpl->textureLoads.clear();
 }
 
 Texture Renderer::createTexture(unsigned char *data, int width, int height)
 {
 	GLuint id;
 	glGenTextures(1, &id);
-	glBindTexture(GL_TEXTURE_2D, id);
+	mRendererImpl->state.bindTexture(0, id);
 
 	// Upload
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
@@ -422,8 +1223,6 @@ Texture Renderer::createTexture(unsigned char *data, int width, int height)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-
 	GLTexture *tex = new GLTexture();
 	tex->id = id;
 	tex->width = width;
@@ -432,269 +1231,1105 @@ Texture Renderer::createTexture(unsigned char *data, int width, int height)
 	return {reinterpret_cast<uintptr_t>(tex), width, height};
 }
 
-Texture Renderer::loadTexture(const char *path)
+// Creates an immutable texture with the cooked mip chain, staged through the
+// per-frame ring buffer when there's room
+static GLuint createCompressedTexture(RendererImpl &impl,
+									  const CookedTexture &cooked)
 {
-	int w, h, channels;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(path, &w, &h, &channels, 4);
+	const TextureFileHeader &header = cooked.header();
+	const GLenum format = cooked.format() == TextureFormat::BC1
+							  ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+							  : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
 
-	if (!data)
+	GLuint id;
+	glCreateTextures(GL_TEXTURE_2D, 1, &id);
+	glTextureStorage2D(id, header.mipCount, format, header.width,
+					   header.height);
+
+	glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	auto staging = impl.frameData.allocate(cooked.dataSize(), 4);
+	if (staging.data)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, impl.frameData.buffer);
+
+	size_t staged = 0;
+	for (uint32_t level = 0; level < header.mipCount; ++level)
 	{
-		std::stringstream ss;
-		ss << "Failed to load " << path;
-		throw std::runtime_error(ss.str());
+		const TextureMip &mip = cooked.mip(level);
+
+		const void *data = cooked.mipData(level);
+		if (staging.data)
+		{
+			memcpy(static_cast<uint8_t *>(staging.data) + staged, data,
+				   mip.size);
+			data = reinterpret_cast<void *>(staging.offset + staged);
+			staged += mip.size;
+		}
+
+		glCompressedTextureSubImage2D(id, level, 0, 0, mip.width, mip.height,
+									  format, mip.size, data);
 	}
 
-	Texture tex = createTexture(data, w, h);
-	stbi_image_free(data);
+	if (staging.data)
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-	return tex;
+	return id;
 }
 
-void Renderer::deleteTexture(Texture texture)
+// Opens the cooked version of path if it's up to date. Cooking is left to
+// --cook-textures, a missing or stale file means loading the source as
+// RGBA8. Safe to call from job system workers.
+static bool openCookedTexture(const char *path, CookedTexture &cooked)
 {
-	assert(texture.id != 0);
+	PROFILE_SCOPE("Renderer::openCookedTexture");
 
-	GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
+	const std::string cookedPath = cookedTexturePath(path);
+	if (textureNeedsCooking(path, cookedPath.c_str()))
+	{
+		std::cerr << "Warning: " << cookedPath
+				  << " is missing or out of date, loading " << path
+				  << " uncompressed (run --cook-textures)" << std::endl;
+		return false;
+	}
 
-	glDeleteTextures(1, &tex->id);
-	delete tex;
+	return cooked.open(cookedPath.c_str());
 }
 
-Mesh Renderer::createQuadMesh()
+// Returns the cached texture for path with its refcount bumped, or an empty
+// handle if it hasn't been loaded
+static Texture acquireCachedTexture(RendererImpl &impl, const char *path,
+									bool atlas)
 {
-	assert(false); // DO NOT TRY AND USE, this is broken
-
-	std::vector<Vertex> vertices = {
-		{{-1, -1, 0}, {0, 0, 1}, {0, 0}},
-		{{1, -1, 0}, {0, 0, 1}, {1, 0}},
-		{{1, 1, 0}, {0, 0, 1}, {1, 1}},
-		{{-1, 1, 0}, {0, 0, 1}, {0, 1}},
-	};
-
-	std::vector<uint32_t> indices = {0, 1, 2, 2, 3, 0};
+	auto &cache = atlas ? impl.atlasTexturesByPath : impl.texturesByPath;
+	auto it = cache.find(path);
+	if (it == cache.end())
+		return {};
 
-	GLMesh glMesh{};
-
-	glGenBuffers(1, &glMesh.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, glMesh.vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-				 vertices.data(), GL_STATIC_DRAW);
+	GLTexture *tex = it->second;
+	tex->refs++;
 
-	glGenBuffers(1, &glMesh.ibo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glMesh.ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t),
-				 indices.data(), GL_STATIC_DRAW);
+	if (tex->loading)
+		return {reinterpret_cast<uintptr_t>(tex), 0, 0};
 
-	glMesh.indexCount = (uint32_t)indices.size();
+	return {reinterpret_cast<uintptr_t>(tex), tex->width, tex->height};
+}
 
-	int64_t id = mRendererImpl->nextMeshId++;
-	mRendererImpl->meshes[id] = glMesh;
+static void cacheTexture(RendererImpl &impl, Texture texture, const char *path,
+						 bool atlas)
+{
+	GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
+	tex->refs = 1;
+	tex->path = path;
+	tex->atlasLoad = atlas;
 
-	return {id};
+	auto &cache = atlas ? impl.atlasTexturesByPath : impl.texturesByPath;
+	cache[tex->path] = tex;
 }
 
-Mesh Renderer::loadMesh(const char *path)
+Texture Renderer::loadTexture(const char *path)
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-
-	std::string err;
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, nullptr, &err, path);
+	if (Texture cached = acquireCachedTexture(*mRendererImpl, path, false);
+		cached.id)
+	{
+		// Loading asynchronously, this caller can't take a placeholder
+		if (reinterpret_cast<GLTexture *>(cached.id)->loading)
+			return finishTextureLoad(cached);
+		return cached;
+	}
 
-	if (!err.empty())
+	CookedTexture cooked;
+	if (openCookedTexture(path, cooked))
 	{
-		std::cerr << err << std::endl;
+		GLTexture *tex = new GLTexture();
+		tex->id = createCompressedTexture(*mRendererImpl, cooked);
+		tex->width = cooked.header().width;
+		tex->height = cooked.header().height;
+
+		Texture texture{reinterpret_cast<uintptr_t>(tex), tex->width,
+						tex->height};
+		cacheTexture(*mRendererImpl, texture, path, false);
+		return texture;
 	}
 
-	if (!ret)
+	// Not cooked, upload it uncompressed
+
+	int w, h, channels;
+	stbi_set_flip_vertically_on_load(true);
+	unsigned char *data = stbi_load(path, &w, &h, &channels, 4);
+
+	if (!data)
 	{
 		std::stringstream ss;
 		ss << "Failed to load " << path;
 		throw std::runtime_error(ss.str());
 	}
 
-	if (shapes.size() > 1)
-	{
-		throw std::runtime_error("Right now only 1 shape is handled.");
-	}
-
-	struct IndexKey
-	{
-		int v;
-		int n;
-		int t;
+	Texture tex = createTexture(data, w, h);
+	stbi_image_free(data);
 
-		bool operator<(const IndexKey &other) const
-		{
-			if (v != other.v)
-				return v < other.v;
-			if (n != other.n)
-				return n < other.n;
-			return t < other.t;
-		}
-	};
+	cacheTexture(*mRendererImpl, tex, path, false);
 
-	std::map<IndexKey, uint32_t> indexMap;
+	return tex;
+}
 
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
+Texture Renderer::finishTextureLoad(Texture texture)
+{
+	auto *impl = mRendererImpl;
+	GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
 
-	for (const auto &shape : shapes)
+	auto &loads = impl->textureLoads;
+	auto it = std::find_if(loads.begin(), loads.end(),
+						   [tex](const std::shared_ptr<TextureLoad> &load)
+						   { return load->target == tex; });
+	if (it != loads.end())
 	{
-		for (const auto &idx : shape.mesh.indices)
-		{
-			IndexKey key{idx.vertex_index, idx.normal_index,
-						 idx.texcoord_index};
+		std::shared_ptr<TextureLoad> load = std::move(*it);
+		loads.erase(it);
 
-			auto it = indexMap.find(key);
-			if (it == indexMap.end())
-			{
-				Vertex v{};
-
-				v.position[0] = attrib.vertices[3 * idx.vertex_index + 0];
-				v.position[1] = attrib.vertices[3 * idx.vertex_index + 1];
-				v.position[2] = attrib.vertices[3 * idx.vertex_index + 2];
-
-				if (idx.normal_index >= 0)
-				{
-					v.normal[0] = attrib.normals[3 * idx.normal_index + 0];
-					v.normal[1] = attrib.normals[3 * idx.normal_index + 1];
-					v.normal[2] = attrib.normals[3 * idx.normal_index + 2];
-				}
-
-				if (idx.texcoord_index >= 0)
-				{
-					v.uv[0] = attrib.texcoords[2 * idx.texcoord_index + 0];
-					v.uv[1] = attrib.texcoords[2 * idx.texcoord_index + 1];
-				}
-
-				uint32_t newIndex = static_cast<uint32_t>(vertices.size());
-				vertices.push_back(v);
-				indexMap[key] = newIndex;
-				indices.push_back(newIndex);
-			}
-			else
-			{
-				indices.push_back(it->second);
-			}
+		if (JobSystem *jobs = Engine::instance->jobs.get())
+			jobs->wait(load->decoded);
+
+		if (load->pixels || load->cooked.isOpen())
+		{
+			uploadTexture(*load);
+		}
+		else
+		{
+			tex->loading = false;
+			tex->failed = true;
 		}
 	}
 
-	GLMesh glMesh{};
-
-	glGenBuffers(1, &glMesh.vbo);
-	glGenBuffers(1, &glMesh.ibo);
-
-	glGenVertexArrays(1, &glMesh.vao);
-	glBindVertexArray(glMesh.vao);
-
-	glBindBuffer(GL_ARRAY_BUFFER, glMesh.vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-				 vertices.data(), GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glMesh.ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t),
-				 indices.data(), GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-						  (void *)offsetof(Vertex, position));
-
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-						  (void *)offsetof(Vertex, normal));
-
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-						  (void *)offsetof(Vertex, uv));
-
-	glBindVertexArray(0);
-
-	glMesh.indexCount = static_cast<uint32_t>(indices.size());
+	if (tex->failed)
+	{
+		std::stringstream ss;
+		ss << "Failed to load " << tex->path;
 
-	int64_t id = mRendererImpl->nextMeshId++;
-	mRendererImpl->meshes[id] = glMesh;
+		deleteTexture(texture); // drop the reference this call took
+		throw std::runtime_error(ss.str());
+	}
 
-	return {id};
+	return {texture.id, tex->width, tex->height};
 }
 
-void Renderer::beginFrame()
+Texture Renderer::loadTextureAsync(const char *path)
 {
-	// Update UBO
-	CameraData data;
-	data.view = Engine::instance->camera->getViewMatrix();
-	data.proj = glm::perspective(
-		glm::radians(50.0f), 1280.0f / 720.0f, 0.1f,
-		100.0f); // Right now the camera doesn't decide projection.
-	data.cameraPos = Engine::instance->camera->position;
-
-	glBindBuffer(GL_UNIFORM_BUFFER, mRendererImpl->cameraUbo);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraData), &data);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	// GL state
-	glEnable(GL_DEPTH_TEST);
-
-	glEnable(GL_BLEND);
-
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_CULL_FACE);
+	return startTextureLoad(path, false);
 }
 
-void Renderer::endFrame()
+Texture Renderer::loadAtlasTexture(const char *path)
 {
-	// stub
+	return startTextureLoad(path, true);
 }
 
-void Renderer::clear(float r, float g, float b)
+Texture Renderer::startTextureLoad(const char *path, bool atlas)
 {
-	glClearColor(r, g, b, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-}
+	auto *impl = mRendererImpl;
 
-void Renderer::setLighting(glm::vec3 lightPos, glm::vec3 lightColor,
-						   glm::vec3 ambient)
-{
-	LightingData data;
-	data.lightPos = lightPos;
-	data.lightColor = lightColor;
-	data.ambient = ambient;
+	if (Texture cached = acquireCachedTexture(*impl, path, atlas); cached.id)
+		return cached;
+
+	GLTexture *tex = new GLTexture();
+	tex->id = impl->whiteTexture;
+	tex->width = 1;
+	tex->height = 1;
+	tex->loading = true;
+
+	auto load = std::make_shared<TextureLoad>();
+	load->path = path;
+	load->target = tex;
+	load->atlas = atlas;
+	impl->textureLoads.push_back(load);
+
+	auto decode = [load]()
+	{
+		// Atlas pages are RGBA8, everything else is uploaded compressed
+		if (!load->atlas && openCookedTexture(load->path.c_str(), load->cooked))
+			return;
+
+		int channels;
+		stbi_set_flip_vertically_on_load_thread(true);
+		load->pixels = stbi_load(load->path.c_str(), &load->width,
+								 &load->height, &channels, 4);
+	};
+
+	if (JobSystem *jobs = Engine::instance->jobs.get())
+		jobs->run(decode, &load->decoded);
+	else
+		decode();
 
-	glBindBuffer(GL_UNIFORM_BUFFER, mRendererImpl->lightingUbo);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightingData), &data);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	Texture texture{reinterpret_cast<uintptr_t>(tex), 0, 0};
+	cacheTexture(*impl, texture, path, atlas);
+
+	return texture;
 }
 
-void Renderer::drawMesh(Mesh mesh, glm::mat4 transform, Texture texture)
+void Renderer::uploadTextures()
 {
-	auto it = mRendererImpl->meshes.find(mesh.id);
-	if (it == mRendererImpl->meshes.end())
+	PROFILE_SCOPE("Renderer::uploadTextures");
+
+	auto *impl = mRendererImpl;
+	auto &loads = impl->textureLoads;
+	if (loads.empty())
 		return;
 
-	const GLMesh &glMesh = it->second;
+	// Headless runs wait for everything so captured frames don't depend on
+	// decode timing
+	const bool blocking = Engine::instance->headless;
 
-	glUseProgram(mRendererImpl->shaderProgram);
+	size_t budget = kTextureUploadBudget;
+	size_t kept = 0;
 
-	glUniformMatrix4fv(
-		glGetUniformLocation(mRendererImpl->shaderProgram, "model"), 1,
-		GL_FALSE, glm::value_ptr(transform));
+	for (size_t i = 0; i < loads.size(); ++i)
+	{
+		auto &load = loads[i];
 
-	glUniform1i(glGetUniformLocation(mRendererImpl->shaderProgram, "uTexture"),
-				0);
+		if (blocking && load->target && Engine::instance->jobs)
+			Engine::instance->jobs->wait(load->decoded);
 
-	glUniform4f(glGetUniformLocation(mRendererImpl->shaderProgram, "uColor"), 1,
-				1, 1, 1);
+		bool finished = !load->target; // deleted while loading
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D,
-				  texture.id != 0
-					  ? reinterpret_cast<GLTexture *>(texture.id)->id
-					  : mRendererImpl->whiteTexture);
+		if (!finished && load->decoded.done())
+		{
+			const size_t size = load->cooked.isOpen()
+									? load->cooked.dataSize()
+									: size_t(load->width) * load->height * 4;
+
+			if (!load->pixels && !load->cooked.isOpen())
+			{
+				std::cerr << "Failed to load " << load->path << std::endl;
+				load->target->loading = false;
+				load->target->failed = true;
+				finished = true;
+			}
+			else if (blocking || budget == kTextureUploadBudget ||
+					 size <= budget)
+			{
+				uploadTexture(*load);
+				budget -= std::min(size, budget);
+				finished = true;
+			}
+		}
+
+		if (!finished)
+			loads[kept++] = std::move(load);
+	}
+
+	loads.resize(kept);
+}
+
+void Renderer::uploadTexture(TextureLoad &load)
+{
+	auto *impl = mRendererImpl;
+
+	if (load.cooked.isOpen())
+	{
+		GLTexture *tex = load.target;
+		tex->id = createCompressedTexture(*impl, load.cooked);
+		tex->width = load.cooked.header().width;
+		tex->height = load.cooked.header().height;
+		tex->loading = false;
+		return;
+	}
+
+	if (load.atlas && load.width <= kMaxAtlasImageSize &&
+		load.height <= kMaxAtlasImageSize && uploadAtlasTexture(load))
+		return;
+
+	GLuint id;
+	glCreateTextures(GL_TEXTURE_2D, 1, &id);
+	glTextureStorage2D(id, 1, GL_RGBA8, load.width, load.height);
+
+	glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Stage through the per-frame ring buffer so the copy into the texture
+	// happens on the GPU timeline (it's a pixel unpack buffer here)
+	const size_t size = size_t(load.width) * load.height * 4;
+	auto staging = impl->frameData.allocate(size, 4);
+	if (staging.data)
+	{
+		memcpy(staging.data, load.pixels, size);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, impl->frameData.buffer);
+		glTextureSubImage2D(id, 0, 0, 0, load.width, load.height, GL_RGBA,
+							GL_UNSIGNED_BYTE,
+							reinterpret_cast<void *>(staging.offset));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	else
+	{
+		// Doesn't fit in what's left of this frame's region
+		glTextureSubImage2D(id, 0, 0, 0, load.width, load.height, GL_RGBA,
+							GL_UNSIGNED_BYTE, load.pixels);
+	}
+
+	GLTexture *tex = load.target;
+	tex->id = id;
+	tex->width = load.width;
+	tex->height = load.height;
+	tex->loading = false;
+}
+
+bool Renderer::uploadAtlasTexture(TextureLoad &load)
+{
+	auto *impl = mRendererImpl;
+	auto &pages = impl->atlasPages;
+
+	const int width = load.width + 2 * kAtlasPadding;
+	const int height = load.height + 2 * kAtlasPadding;
+
+	// Newest page first, older ones are usually full
+	int x = 0, y = 0;
+	AtlasPage *page = nullptr;
+	for (auto it = pages.rbegin(); it != pages.rend(); ++it)
+	{
+		if (it->packer.pack(width, height, x, y))
+		{
+			page = &*it;
+			break;
+		}
+	}
+
+	if (!page)
+	{
+		page = &pages.emplace_back();
+		if (!page->packer.pack(width, height, x, y))
+		{
+			pages.pop_back();
+			return false;
+		}
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &page->texture);
+		glTextureStorage2D(page->texture, 1, GL_RGBA8, kAtlasPageSize,
+						   kAtlasPageSize);
+
+		glTextureParameteri(page->texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(page->texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(page->texture, GL_TEXTURE_WRAP_S,
+							GL_CLAMP_TO_EDGE);
+		glTextureParameteri(page->texture, GL_TEXTURE_WRAP_T,
+							GL_CLAMP_TO_EDGE);
+	}
+
+	// Copy in with the edges extruded into the padding
+	const size_t size = size_t(width) * height * 4;
+	auto staging = impl->frameData.allocate(size, 4);
+
+	std::vector<unsigned char> fallback;
+	unsigned char *dst = static_cast<unsigned char *>(staging.data);
+	if (!dst)
+	{
+		fallback.resize(size);
+		dst = fallback.data();
+	}
+
+	for (int row = 0; row < height; ++row)
+	{
+		const int srcRow = std::clamp(row - kAtlasPadding, 0, load.height - 1);
+		const unsigned char *src =
+			load.pixels + size_t(srcRow) * load.width * 4;
+		unsigned char *out = dst + size_t(row) * width * 4;
+
+		memcpy(out + kAtlasPadding * 4, src, size_t(load.width) * 4);
+		for (int i = 0; i < kAtlasPadding; ++i)
+		{
+			memcpy(out + i * 4, src, 4);
+			memcpy(out + (kAtlasPadding + load.width + i) * 4,
+				   src + (load.width - 1) * 4, 4);
+		}
+	}
+
+	if (staging.data)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, impl->frameData.buffer);
+		glTextureSubImage2D(page->texture, 0, x, y, width, height, GL_RGBA,
+							GL_UNSIGNED_BYTE,
+							reinterpret_cast<void *>(staging.offset));
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	else
+	{
+		glTextureSubImage2D(page->texture, 0, x, y, width, height, GL_RGBA,
+							GL_UNSIGNED_BYTE, dst);
+	}
+
+	const float scale = 1.f / kAtlasPageSize;
+	const float u0 = float(x + kAtlasPadding) * scale;
+	const float v0 = float(y + kAtlasPadding) * scale;
+
+	GLTexture *tex = load.target;
+	tex->id = page->texture;
+	tex->width = load.width;
+	tex->height = load.height;
+	tex->uvRect = {u0, v0, u0 + load.width * scale, v0 + load.height * scale};
+	tex->inAtlas = true;
+	tex->loading = false;
+
+	return true;
+}
+
+// Retained UI quads keep their texture across frames. Drops tex from
+// them so they fall back to white instead of reading a deleted texture.
+static void forgetUITexture(RendererImpl &impl, const GLTexture *tex)
+{
+	for (auto &[id, list] : impl.uiQuadLists)
+	{
+		for (auto &quadTexture : list.textures)
+		{
+			if (quadTexture != tex)
+				continue;
+
+			quadTexture = nullptr;
+			list.rebatch = true;
+		}
+	}
+}
+
+void Renderer::deleteTexture(Texture texture)
+{
+	assert(texture.id != 0);
+
+	GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
+
+	// Shared, only the last reference deletes it
+	if (tex->refs > 1)
+	{
+		tex->refs--;
+		return;
+	}
+
+	if (tex->refs == 1)
+	{
+		auto &cache = tex->atlasLoad ? mRendererImpl->atlasTexturesByPath
+									 : mRendererImpl->texturesByPath;
+		cache.erase(tex->path);
+	}
+
+	forgetUITexture(*mRendererImpl, tex);
+
+	// Still showing the placeholder, just cancel the load
+	if (tex->loading)
+	{
+		for (auto &load : mRendererImpl->textureLoads)
+		{
+			if (load->target == tex)
+				load->target = nullptr;
+		}
+
+		delete tex;
+		return;
+	}
+
+	// Atlas space isn't reclaimed, the page stays as it is. Failed loads
+	// never owned the shared white placeholder they show.
+	if (tex->inAtlas || tex->failed || tex->id == mRendererImpl->whiteTexture)
+	{
+		delete tex;
+		return;
+	}
+
+	// GL unbinds deleted textures, keep the cache in sync
+	for (auto &bound : mRendererImpl->state.textures)
+	{
+		if (bound == tex->id)
+			bound = 0;
+	}
+
+	glDeleteTextures(1, &tex->id);
+	delete tex;
+}
+
+Mesh Renderer::createQuadMesh()
+{
+	assert(false); // DO NOT TRY AND USE, this is broken
+
+	std::vector<Vertex> vertices = {
+		{{-1, -1, 0}, {0, 0, 1}, {0, 0}},
+		{{1, -1, 0}, {0, 0, 1}, {1, 0}},
+		{{1, 1, 0}, {0, 0, 1}, {1, 1}},
+		{{-1, 1, 0}, {0, 0, 1}, {0, 1}},
+	};
+
+	std::vector<uint32_t> indices = {0, 1, 2, 2, 3, 0};
+
+	GLMesh glMesh{};
+
+	glGenBuffers(1, &glMesh.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, glMesh.vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
+				 vertices.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &glMesh.ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glMesh.ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t),
+				 indices.data(), GL_STATIC_DRAW);
+
+	glMesh.indexCount = (uint32_t)indices.size();
+	glMesh.indexType = GL_UNSIGNED_INT;
+	glMesh.boundsMin = glm::vec3(-1, -1, 0);
+	glMesh.boundsMax = glm::vec3(1, 1, 0);
+
+	int64_t id = mRendererImpl->nextMeshId++;
+	mRendererImpl->meshes[id] = glMesh;
+
+	return {id};
+}
+
+Mesh Renderer::loadMesh(const char *path)
+{
+	auto *impl = mRendererImpl;
+
+	auto cached = impl->meshesByPath.find(path);
+	if (cached != impl->meshesByPath.end())
+	{
+		impl->meshes[cached->second].refs++;
+		return {cached->second};
+	}
+
+	Mesh mesh = loadMeshFile(path);
+
+	GLMesh &glMesh = impl->meshes[mesh.id];
+	glMesh.refs = 1;
+	glMesh.path = path;
+	impl->meshesByPath[glMesh.path] = mesh.id;
+
+	return mesh;
+}
+
+void Renderer::deleteMesh(Mesh mesh)
+{
+	auto *impl = mRendererImpl;
+
+	auto it = impl->meshes.find(mesh.id);
+	if (it == impl->meshes.end())
+		return;
+
+	GLMesh &glMesh = it->second;
+
+	// Shared, only the last reference deletes it
+	if (glMesh.refs > 1)
+	{
+		glMesh.refs--;
+		return;
+	}
+
+	if (glMesh.refs == 1)
+		impl->meshesByPath.erase(glMesh.path);
+
+	// GL unbinds deleted vertex arrays, keep the cache in sync
+	if (impl->state.vertexArray == glMesh.vao)
+		impl->state.vertexArray = 0;
+
+	glDeleteVertexArrays(1, &glMesh.vao);
+	glDeleteBuffers(1, &glMesh.vbo);
+	glDeleteBuffers(1, &glMesh.ibo);
+
+	impl->meshes.erase(it);
+}
+
+Mesh Renderer::loadMeshFile(const char *path)
+{
+	PROFILE_SCOPE("Renderer::loadMesh");
+
+	const std::string cookedPath = cookedMeshPath(path);
+
+	// Cooked meshes are mapped and uploaded as is, no parsing
+	CookedMesh cooked;
+	if (!meshNeedsCooking(path, cookedPath.c_str()) &&
+		cooked.open(cookedPath.c_str()))
+	{
+		const MeshFileHeader &header = cooked.header();
+		return uploadMesh(
+			cooked.vertices(), header.vertexCount, cooked.indices(),
+			header.indexCount, header.indexSize,
+			glm::vec3(header.boundsMin[0], header.boundsMin[1],
+					  header.boundsMin[2]),
+			glm::vec3(header.boundsMax[0], header.boundsMax[1],
+					  header.boundsMax[2]));
+	}
+
+	// First run, or the source changed: import, optimize and cook for
+	// next time
+	const uint64_t importStart = Profiler::now();
+	MeshData data = importObj(path);
+
+	const uint64_t optimizeStart = Profiler::now();
+	const float acmrBefore =
+		computeAcmr(data.indices, data.vertices.size());
+	optimizeVertexCache(data.indices, data.vertices.size());
+	optimizeVertexFetch(data);
+	const float acmrAfter = computeAcmr(data.indices, data.vertices.size());
+	const uint64_t optimizeEnd = Profiler::now();
+
+	if (writeCookedMesh(cookedPath.c_str(), data))
+	{
+		std::cout << "Cooked " << path << ": " << data.vertices.size()
+				  << " vertices, " << data.indices.size() / 3
+				  << " triangles, import "
+				  << (optimizeStart - importStart) * 1e-6 << " ms, optimize "
+				  << (optimizeEnd - optimizeStart) * 1e-6 << " ms, ACMR "
+				  << acmrBefore << " -> " << acmrAfter << std::endl;
+	}
+	else
+	{
+		std::cerr << "Failed to write " << cookedPath << std::endl;
+	}
+
+	return uploadMesh(data.vertices.data(),
+					  static_cast<uint32_t>(data.vertices.size()),
+					  data.indices.data(),
+					  static_cast<uint32_t>(data.indices.size()),
+					  sizeof(uint32_t), data.boundsMin, data.boundsMax);
+}
+
+Mesh Renderer::uploadMesh(const void *vertices, uint32_t vertexCount,
+						  const void *indices, uint32_t indexCount,
+						  uint32_t indexSize, glm::vec3 boundsMin,
+						  glm::vec3 boundsMax)
+{
+	GLMesh glMesh{};
+
+	glGenBuffers(1, &glMesh.vbo);
+	glGenBuffers(1, &glMesh.ibo);
+
+	glGenVertexArrays(1, &glMesh.vao);
+	mRendererImpl->state.bindVertexArray(glMesh.vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, glMesh.vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices,
+				 GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, glMesh.ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize, indices,
+				 GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+						  (void *)offsetof(Vertex, position));
+
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+						  (void *)offsetof(Vertex, normal));
+
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+						  (void *)offsetof(Vertex, uv));
+
+	mRendererImpl->state.bindVertexArray(0);
+
+	glMesh.indexCount = indexCount;
+	glMesh.indexType =
+		indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	glMesh.boundsMin = boundsMin;
+	glMesh.boundsMax = boundsMax;
+
+	int64_t id = mRendererImpl->nextMeshId++;
+	mRendererImpl->meshes[id] = glMesh;
+
+	return {id};
+}
+
+void Renderer::beginFrame()
+{
+	PROFILE_SCOPE("Renderer::beginFrame");
+
+	auto *impl = mRendererImpl;
+
+	// Blocks if the GPU is still reading this region
+	impl->frameData.nextFrame();
+	impl->inFrame = true;
+
+	// Publish last frame's counts
+	for (size_t i = 0; i < kRenderPassCount; ++i)
+	{
+		impl->passStats[i] = impl->passCounts[i];
+		impl->passStats[i].gpuMs = impl->passTimers[i].ms;
+		impl->passCounts[i] = {};
+	}
+
+	impl->cullStats = impl->cullCounts;
+	impl->cullCounts = {};
+
+	// Update UBO
+	CameraData data;
+	data.view = Engine::instance->camera->getViewMatrix();
+	data.proj = glm::perspective(
+		glm::radians(50.0f), 1280.0f / 720.0f, 0.1f,
+		100.0f); // Right now the camera doesn't decide projection.
+	data.cameraPos = Engine::instance->camera->position;
+
+	impl->frustum = Frustum::fromMatrix(data.proj * data.view);
+
+	uploadUniforms(0, &data, sizeof(CameraData));
+	uploadUniforms(1, &impl->lighting, sizeof(LightingData));
+
+	uploadTextures();
+
+	// Other code (ImGui) binds GL objects between our frames
+	mRendererImpl->state.invalidate();
+
+	if (impl->offscreenFbo != 0)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, impl->offscreenFbo);
+		glViewport(0, 0, impl->offscreenWidth, impl->offscreenHeight);
+	}
+
+	// GL state
+	glEnable(GL_DEPTH_TEST);
+
+	glEnable(GL_BLEND);
+
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_CULL_FACE);
+
+	beginPass(RenderPass::Scene);
+}
+
+void Renderer::endFrame()
+{
+	flushQuads();
+	endPass(RenderPass::Scene);
+	mRendererImpl->inFrame = false;
+}
+
+bool Renderer::createOffscreenTarget(int width, int height)
+{
+	auto *impl = mRendererImpl;
+
+	glCreateRenderbuffers(1, &impl->offscreenColor);
+	glNamedRenderbufferStorage(impl->offscreenColor, GL_RGBA8, width, height);
+
+	glCreateRenderbuffers(1, &impl->offscreenDepth);
+	glNamedRenderbufferStorage(impl->offscreenDepth, GL_DEPTH24_STENCIL8,
+							   width, height);
+
+	glCreateFramebuffers(1, &impl->offscreenFbo);
+	glNamedFramebufferRenderbuffer(impl->offscreenFbo, GL_COLOR_ATTACHMENT0,
+								   GL_RENDERBUFFER, impl->offscreenColor);
+	glNamedFramebufferRenderbuffer(impl->offscreenFbo,
+								   GL_DEPTH_STENCIL_ATTACHMENT,
+								   GL_RENDERBUFFER, impl->offscreenDepth);
+
+	if (glCheckNamedFramebufferStatus(impl->offscreenFbo, GL_FRAMEBUFFER) !=
+		GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cerr << "Offscreen framebuffer is incomplete" << std::endl;
+		return false;
+	}
+
+	impl->offscreenWidth = width;
+	impl->offscreenHeight = height;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, impl->offscreenFbo);
+	glViewport(0, 0, width, height);
+
+	return true;
+}
+
+bool Renderer::saveFrame(const char *path)
+{
+	auto *impl = mRendererImpl;
+
+	int width = impl->offscreenWidth;
+	int height = impl->offscreenHeight;
+	if (impl->offscreenFbo == 0)
+	{
+		GLint viewport[4] = {};
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		width = viewport[2];
+		height = viewport[3];
+	}
+
+	std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 4);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, impl->offscreenFbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+				 pixels.data());
+
+	// GL rows start at the bottom
+	stbi_flip_vertically_on_write(1);
+	if (!stbi_write_png(path, width, height, 4, pixels.data(), width * 4))
+	{
+		std::cerr << "Failed to write " << path << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+void Renderer::beginPass(RenderPass pass)
+{
+	auto *impl = mRendererImpl;
+
+	// GL_TIME_ELAPSED queries can't nest
+	assert(impl->currentPass < 0);
+
+	impl->currentPass = static_cast<int>(pass);
+	impl->passTimers[impl->currentPass].begin();
+}
+
+void Renderer::endPass(RenderPass pass)
+{
+	auto *impl = mRendererImpl;
+
+	assert(impl->currentPass == static_cast<int>(pass));
+
+	impl->passTimers[static_cast<size_t>(pass)].end();
+	impl->currentPass = -1;
+}
+
+void Renderer::countDraws(RenderPass pass, uint32_t drawCalls,
+						  uint64_t triangles)
+{
+	auto &counts = mRendererImpl->passCounts[static_cast<size_t>(pass)];
+	counts.drawCalls += drawCalls;
+	counts.triangles += triangles;
+}
+
+RenderPassStats Renderer::passStats(RenderPass pass) const
+{
+	return mRendererImpl->passStats[static_cast<size_t>(pass)];
+}
+
+const Frustum &Renderer::frustum() const { return mRendererImpl->frustum; }
+
+void Renderer::countCulling(uint32_t drawn, uint32_t culled)
+{
+	mRendererImpl->cullCounts.drawn += drawn;
+	mRendererImpl->cullCounts.culled += culled;
+}
+
+CullStats Renderer::cullStats() const { return mRendererImpl->cullStats; }
+
+void Renderer::clear(float r, float g, float b)
+{
+	glClearColor(r, g, b, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void Renderer::setLighting(glm::vec3 lightPos, glm::vec3 lightColor,
+						   glm::vec3 ambient)
+{
+	LightingData &data = mRendererImpl->lighting;
+	data.lightPos = lightPos;
+	data.lightColor = lightColor;
+	data.ambient = ambient;
+
+	// Otherwise picked up by the next beginFrame
+	if (mRendererImpl->inFrame)
+		uploadUniforms(1, &data, sizeof(LightingData));
+}
+
+void *Renderer::allocateFrameData(size_t size, size_t alignment,
+								  uintptr_t &offset)
+{
+	auto allocation = mRendererImpl->frameData.allocate(size, alignment);
+	if (!allocation.data)
+	{
+		if (!mRendererImpl->warnedFrameDataFull)
+		{
+			std::cerr << "Per-frame buffer full, dropping draws" << std::endl;
+			mRendererImpl->warnedFrameDataFull = true;
+		}
+		return nullptr;
+	}
+
+	offset = static_cast<uintptr_t>(allocation.offset);
+	return allocation.data;
+}
+
+void Renderer::uploadUniforms(uint32_t binding, const void *data, size_t size)
+{
+	uintptr_t offset;
+	void *dst =
+		allocateFrameData(size, mRendererImpl->uniformAlignment, offset);
+	if (!dst)
+		return;
+
+	memcpy(dst, data, size);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding,
+					  mRendererImpl->frameData.buffer,
+					  static_cast<GLintptr>(offset), size);
+}
+
+void Renderer::drawMesh(Mesh mesh, glm::mat4 transform, Texture texture)
+{
+	PROFILE_SCOPE("Renderer::drawMesh");
+
+	auto it = mRendererImpl->meshes.find(mesh.id);
+	if (it == mRendererImpl->meshes.end())
+		return;
+
+	const GLMesh &glMesh = it->second;
+
+	auto *impl = mRendererImpl;
+
+	// World space box around the transformed bounds (Arvo's method)
+	const glm::vec3 center = (glMesh.boundsMin + glMesh.boundsMax) * 0.5f;
+	const glm::vec3 extent = (glMesh.boundsMax - glMesh.boundsMin) * 0.5f;
+	const glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1));
+	glm::vec3 worldExtent(0.f);
+	for (int i = 0; i < 3; ++i)
+		worldExtent += glm::abs(glm::vec3(transform[i])) * extent[i];
+
+	if (!impl->frustum.intersectsAabb(worldCenter - worldExtent,
+									  worldCenter + worldExtent))
+	{
+		countCulling(0, 1);
+		return;
+	}
+	countCulling(1, 0);
+
+	impl->meshProgram.set(Uniform::Model, transform);
+	impl->meshProgram.set(Uniform::Color, glm::vec4(1, 1, 1, 1));
+
+	GLuint textureId = impl->whiteTexture;
+	if (texture.id != 0)
+	{
+		const GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
+
+		// Meshes sample the whole texture, uvRect isn't applied
+		assert(!tex->inAtlas && "atlas textures only work with quads");
+		textureId = tex->id;
+	}
+
+	impl->state.useProgram(impl->meshProgram.id);
+	impl->state.bindTexture(0, textureId);
+	impl->state.bindVertexArray(glMesh.vao);
+
+	glDrawElements(GL_TRIANGLES, glMesh.indexCount, glMesh.indexType, nullptr);
+	impl->countDraw(glMesh.indexCount / 3);
+}
+
+void Renderer::benchDrawState(int draws, double &cachedMs,
+							  double &uncachedMs)
+{
+	auto *impl = mRendererImpl;
+
+	// One tiny triangle so the GPU side is next to free
+	const Vertex vertices[3] = {{{0, 0, 0}, {0, 0, 1}, {0, 0}},
+								{{1, 0, 0}, {0, 0, 1}, {1, 0}},
+								{{0, 1, 0}, {0, 0, 1}, {0, 1}}};
+	const uint32_t indices[3] = {0, 1, 2};
+
+	GLuint vao, vbo, ibo;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+				 GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+						  (void *)offsetof(Vertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+						  (void *)offsetof(Vertex, normal));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+						  (void *)offsetof(Vertex, uv));
 
-	glBindVertexArray(glMesh.vao);
-	glDrawElements(GL_TRIANGLES, glMesh.indexCount, GL_UNSIGNED_INT, nullptr);
 	glBindVertexArray(0);
+
+	// Two textures switched every few draws, like a scene sorted by
+	// material
+	unsigned char pixel[4] = {255, 255, 255, 255};
+	const Texture textures[2] = {createTexture(pixel, 1, 1),
+								 createTexture(pixel, 1, 1)};
+	constexpr int kTextureRun = 8;
+
+	const GLuint program = impl->meshProgram.id;
+	auto transformOf = [](int draw)
+	{
+		const glm::vec3 position(float(draw % 100), 0.f, -50.f);
+		return glm::scale(glm::translate(glm::mat4(1.f), position),
+						  glm::vec3(0.001f));
+	};
+	auto textureOf = [&textures](int draw)
+	{
+		const Texture &t = textures[(draw / kTextureRun) % 2];
+		return reinterpret_cast<GLTexture *>(t.id)->id;
+	};
+
+	// What drawMesh does, minus culling
+	auto drawCached = [&]()
+	{
+		for (int i = 0; i < draws; ++i)
+		{
+			impl->meshProgram.set(Uniform::Model, transformOf(i));
+			impl->meshProgram.set(Uniform::Color, glm::vec4(1, 1, 1, 1));
+
+			impl->state.useProgram(program);
+			impl->state.bindTexture(0, textureOf(i));
+			impl->state.bindVertexArray(vao);
+
+			glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, nullptr);
+		}
+	};
+
+	// The same with every bind issued and uniforms looked up by name
+	auto drawUncached = [&]()
+	{
+		for (int i = 0; i < draws; ++i)
+		{
+			glProgramUniformMatrix4fv(
+				program, glGetUniformLocation(program, "model"), 1, GL_FALSE,
+				glm::value_ptr(transformOf(i)));
+			glProgramUniform4f(program, glGetUniformLocation(program, "uColor"),
+							   1.f, 1.f, 1.f, 1.f);
+
+			glUseProgram(program);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, textureOf(i));
+			glBindVertexArray(vao);
+
+			glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, nullptr);
+		}
+	};
+
+	// Best of a few alternating runs, each waits for the GPU to finish
+	auto time = [](const auto &fn)
+	{
+		using Clock = std::chrono::steady_clock;
+		glFinish();
+		const auto start = Clock::now();
+		fn();
+		glFinish();
+		return std::chrono::duration<double, std::milli>(Clock::now() - start)
+			.count();
+	};
+
+	constexpr int kRuns = 5;
+	cachedMs = uncachedMs = 1e30;
+	for (int run = 0; run < kRuns; ++run)
+	{
+		impl->state.invalidate();
+		cachedMs = std::min(cachedMs, time(drawCached));
+		uncachedMs = std::min(uncachedMs, time(drawUncached));
+	}
+
+	// The uncached draws bound behind the cache's back
+	impl->state.invalidate();
+
+	deleteTexture(textures[0]);
+	deleteTexture(textures[1]);
+
+	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &ibo);
+	glDeleteVertexArrays(1, &vao);
 }
 
 void Renderer::drawQuad(glm::vec3 position, glm::vec3 rotation, glm::vec3 size,
@@ -713,71 +2348,568 @@ void Renderer::drawQuad(glm::vec3 position, glm::vec3 rotation, glm::vec3 size,
 	// Scale
 	model = glm::scale(model, glm::vec3(size.x, size.y, 1.0f));
 
-	glUseProgram(mRendererImpl->shaderProgram);
+	// Queue, actual drawing happens in flushQuads
+	QuadBatchKey key;
+	glm::vec4 uvRect(0.f, 0.f, 1.f, 1.f);
+	if (texture.id != 0)
+	{
+		const GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
+		key.texture = tex->id;
+		uvRect = tex->uvRect;
+	}
+	else
+	{
+		key.texture = mRendererImpl->whiteTexture;
+	}
+	key.translucent = color.a < 1.0f;
+	key.order = static_cast<uint32_t>(mRendererImpl->quadKeys.size());
+
+	mRendererImpl->quadKeys.push_back(key);
+	mRendererImpl->quadInstances.push_back({model, color, uvRect});
+}
+
+void Renderer::flushQuads()
+{
+	PROFILE_SCOPE("Renderer::flushQuads");
 
-	glUniformMatrix4fv(
-		glGetUniformLocation(mRendererImpl->shaderProgram, "model"), 1,
-		GL_FALSE, glm::value_ptr(model));
+	auto *impl = mRendererImpl;
 
-	glUniform1i(glGetUniformLocation(mRendererImpl->shaderProgram, "uTexture"),
-				0);
+	const size_t count = impl->quadInstances.size();
+	if (count == 0)
+		return;
 
-	glUniform4fv(glGetUniformLocation(mRendererImpl->shaderProgram, "uColor"),
-				 1, glm::value_ptr(color));
+	// Opaque quads first, grouped by texture. Translucent quads after, in
+	// submission order so blending stays the same as unbatched drawing.
+	// Blending stays enabled for both, textures can still have soft edges.
+	auto &order = impl->quadSortOrder;
+	order.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+		order[i] = i;
+
+	const auto &keys = impl->quadKeys;
+	std::sort(order.begin(), order.end(),
+			  [&keys](uint32_t a, uint32_t b)
+			  {
+				  const QuadBatchKey &ka = keys[a];
+				  const QuadBatchKey &kb = keys[b];
+
+				  if (ka.translucent != kb.translucent)
+					  return !ka.translucent;
+				  if (!ka.translucent && ka.texture != kb.texture)
+					  return ka.texture < kb.texture;
+				  return ka.order < kb.order;
+			  });
+
+	// Write sorted straight into the mapped buffer. If the frame's region
+	// is out of space, sort into scratch and upload to the overflow buffer
+	// so nothing gets dropped.
+	const size_t size = count * sizeof(QuadInstance);
+	auto allocation = impl->frameData.allocate(size, alignof(QuadInstance));
+
+	QuadInstance *sorted;
+	if (allocation.data)
+	{
+		sorted = static_cast<QuadInstance *>(allocation.data);
+	}
+	else
+	{
+		impl->quadOverflow.resize(count);
+		sorted = impl->quadOverflow.data();
+	}
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D,
-				  texture.id != 0
-					  ? reinterpret_cast<GLTexture *>(texture.id)->id
-					  : mRendererImpl->whiteTexture);
+	for (size_t i = 0; i < count; ++i)
+		sorted[i] = impl->quadInstances[order[i]];
 
-	glBindVertexArray(mRendererImpl->quadVao);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
+	if (allocation.data)
+	{
+		glVertexArrayVertexBuffer(impl->quadVao, kQuadInstanceBinding,
+								  impl->frameData.buffer, allocation.offset,
+								  sizeof(QuadInstance));
+	}
+	else
+	{
+		if (impl->quadOverflowVbo == 0)
+			glCreateBuffers(1, &impl->quadOverflowVbo);
+
+		if (size > impl->quadOverflowCapacity)
+		{
+			impl->quadOverflowCapacity = size + size / 2;
+			std::cerr << "Per-frame buffer full, " << count
+					  << " quads going through the overflow buffer ("
+					  << impl->quadOverflowCapacity / 1024 << " KB)"
+					  << std::endl;
+		}
+
+		// Orphan so this doesn't wait on last frame's draws
+		glNamedBufferData(impl->quadOverflowVbo, impl->quadOverflowCapacity,
+						  nullptr, GL_STREAM_DRAW);
+		glNamedBufferSubData(impl->quadOverflowVbo, 0, size, sorted);
+
+		glVertexArrayVertexBuffer(impl->quadVao, kQuadInstanceBinding,
+								  impl->quadOverflowVbo, 0,
+								  sizeof(QuadInstance));
+	}
+
+	impl->state.useProgram(impl->quadProgram.id);
+	impl->state.bindVertexArray(impl->quadVao);
+
+	// Emit one instanced draw per run of same texture + blend state
+	size_t runStart = 0;
+	while (runStart < count)
+	{
+		const QuadBatchKey &key = keys[order[runStart]];
+
+		size_t runEnd = runStart + 1;
+		while (runEnd < count)
+		{
+			const QuadBatchKey &next = keys[order[runEnd]];
+			if (next.texture != key.texture ||
+				next.translucent != key.translucent)
+				break;
+			++runEnd;
+		}
+
+		impl->state.bindTexture(0, key.texture);
+		glDrawArraysInstancedBaseInstance(
+			GL_TRIANGLES, 0, 6, static_cast<GLsizei>(runEnd - runStart),
+			static_cast<GLuint>(runStart));
+		impl->countDraw((runEnd - runStart) * 2);
+
+		runStart = runEnd;
+	}
+
+	impl->quadInstances.clear();
+	impl->quadKeys.clear();
 }
 
 void Renderer::begin2D(int screenWidth, int screenHeight)
 {
-	mRendererImpl->uiProj =
+	auto *impl = mRendererImpl;
+
+	impl->uiProj =
 		glm::ortho(0.0f, static_cast<float>(screenWidth),
 				   static_cast<float>(screenHeight), 0.0f, -1.0f, 1.0f);
 
+	glGetIntegerv(GL_VIEWPORT, impl->uiViewport);
+	impl->uiScale =
+		glm::vec2(static_cast<float>(impl->uiViewport[2]) / screenWidth,
+				  static_cast<float>(impl->uiViewport[3]) / screenHeight);
+
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	beginPass(RenderPass::UI);
+}
+
+void Renderer::end2D()
+{
+	flushUI();
+	endPass(RenderPass::UI);
 }
 
-void Renderer::end2D() {}
+// Writes the 4 vertices of a quad from p0 (top left) to p1
+static void setUIQuad(UIVertex *v, glm::vec2 p0, glm::vec2 p1,
+					  glm::vec4 color, glm::vec4 uv, uint32_t slot)
+{
+	// UVs are flipped vertically, textures are loaded bottom-up
+	v[0] = {{p0.x, p0.y}, {uv.x, uv.w}, color, slot};
+	v[1] = {{p1.x, p0.y}, {uv.z, uv.w}, color, slot};
+	v[2] = {{p1.x, p1.y}, {uv.z, uv.y}, color, slot};
+	v[3] = {{p0.x, p1.y}, {uv.x, uv.y}, color, slot};
+}
 
-void Renderer::drawUIQuad(glm::vec2 position, glm::vec2 size, glm::vec4 color, Texture texture)
+void Renderer::drawUIQuad(glm::vec2 position, glm::vec2 size, glm::vec4 color,
+						  Texture texture)
 {
-	glm::mat4 model = glm::mat4(1.0f);
+	auto *impl = mRendererImpl;
+
+	GLuint textureId = impl->whiteTexture;
+	glm::vec4 uv(0.f, 0.f, 1.f, 1.f);
+	if (texture.id != 0)
+	{
+		const GLTexture *tex = reinterpret_cast<GLTexture *>(texture.id);
+		textureId = tex->id;
+		uv = tex->uvRect;
+	}
+
+	// Find the texture's slot in this batch, starting a new batch if all
+	// slots are taken or the batch is full
+	uint32_t slot = 0;
+	while (slot < impl->uiTextureCount && impl->uiTextures[slot] != textureId)
+		++slot;
 
-	model = glm::translate(glm::mat4(1.0f), glm::vec3(position, 0.0f));
+	if (slot == kUITextureSlots ||
+		impl->uiVertices.size() >= kMaxUIQuads * 4)
+	{
+		flushUI();
+		slot = 0;
+	}
+
+	if (slot == impl->uiTextureCount)
+		impl->uiTextures[impl->uiTextureCount++] = textureId;
+
+	const size_t first = impl->uiVertices.size();
+	impl->uiVertices.resize(first + 4);
+	setUIQuad(&impl->uiVertices[first], position, position + size, color, uv,
+			  slot);
+}
+
+void Renderer::flushUI()
+{
+	PROFILE_SCOPE("Renderer::flushUI");
+
+	auto *impl = mRendererImpl;
 
-	model = glm::scale(model, glm::vec3(size, 1.0f));
+	const size_t vertexCount = impl->uiVertices.size();
+	if (vertexCount == 0)
+		return;
+
+	uintptr_t offset;
+	void *dst = allocateFrameData(vertexCount * sizeof(UIVertex),
+								  alignof(UIVertex), offset);
+	if (!dst)
+	{
+		impl->uiVertices.clear();
+		impl->uiTextureCount = 0;
+		return;
+	}
 
-	glm::mat4 mvp = mRendererImpl->uiProj * model;
+	memcpy(dst, impl->uiVertices.data(), vertexCount * sizeof(UIVertex));
 
-	glUseProgram(mRendererImpl->uiShader);
+	glVertexArrayVertexBuffer(impl->uiVao, 0, impl->frameData.buffer,
+							  static_cast<GLintptr>(offset), sizeof(UIVertex));
 
-	glUniformMatrix4fv(glGetUniformLocation(mRendererImpl->uiShader, "uMVP"), 1,
-					   GL_FALSE, glm::value_ptr(mvp));
+	impl->uiProgram.set(Uniform::MVP, impl->uiProj);
 
-	glUniform4fv(glGetUniformLocation(mRendererImpl->uiShader, "uColor"), 1,
-				 glm::value_ptr(color));
+	impl->state.useProgram(impl->uiProgram.id);
+	for (uint32_t i = 0; i < impl->uiTextureCount; ++i)
+		impl->state.bindTexture(i, impl->uiTextures[i]);
+	impl->state.bindVertexArray(impl->uiVao);
 
-	glUniform1i(glGetUniformLocation(mRendererImpl->uiShader, "uTexture"),
-				0);
+	const GLsizei indexCount = static_cast<GLsizei>(vertexCount / 4 * 6);
+	glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, nullptr);
+	impl->countDraw(indexCount / 3);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D,
-				  texture.id != 0
-					  ? reinterpret_cast<GLTexture *>(texture.id)->id
-					  : mRendererImpl->whiteTexture);
+	impl->uiVertices.clear();
+	impl->uiTextureCount = 0;
+}
 
-	glBindVertexArray(mRendererImpl->uiVao);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
+UIQuadList Renderer::createUIQuadList()
+{
+	auto *impl = mRendererImpl;
+
+	const int64_t id = impl->nextUIQuadListId++;
+	impl->uiQuadLists.emplace(id, GLUIQuadList{});
+	return UIQuadList{id};
+}
+
+void Renderer::deleteUIQuadList(UIQuadList list)
+{
+	auto *impl = mRendererImpl;
+
+	auto it = impl->uiQuadLists.find(list.id);
+	if (it == impl->uiQuadLists.end())
+		return;
+
+	glDeleteBuffers(1, &it->second.vbo);
+	impl->uiQuadLists.erase(it);
+}
+
+void Renderer::resizeUIQuadList(UIQuadList list, uint32_t quadCount)
+{
+	auto it = mRendererImpl->uiQuadLists.find(list.id);
+	if (it == mRendererImpl->uiQuadLists.end())
+		return;
+
+	GLUIQuadList &glList = it->second;
+
+	glList.vertices.resize(size_t(quadCount) * 4, UIVertex{});
+	glList.textures.resize(quadCount, nullptr);
+	glList.clips.resize(quadCount, 0);
+	glList.rebatch = true;
+
+	auto &loading = glList.loadingQuads;
+	loading.erase(std::remove_if(loading.begin(), loading.end(),
+								 [quadCount](uint32_t quad)
+								 { return quad >= quadCount; }),
+				  loading.end());
+}
+
+// Finds (or adds) the texture in the batch holding quad. Returns false if
+// the batch has no free slot, the list then needs rebatching.
+static bool assignUIQuadSlot(GLUIQuadList &list, uint32_t quad,
+							 GLuint textureId, uint32_t &slot)
+{
+	auto it = std::upper_bound(list.batches.begin(), list.batches.end(), quad,
+							   [](uint32_t q, const UIQuadBatch &batch)
+							   { return q < batch.firstQuad; });
+	if (it == list.batches.begin())
+		return false;
+
+	UIQuadBatch &batch = *(it - 1);
+	if (quad >= batch.firstQuad + batch.quadCount ||
+		batch.clip != list.clips[quad])
+		return false;
+
+	slot = 0;
+	while (slot < batch.textureCount && batch.textures[slot] != textureId)
+		++slot;
+
+	if (slot == batch.textureCount)
+	{
+		if (batch.textureCount == kUITextureSlots)
+			return false;
+
+		batch.textures[batch.textureCount++] = textureId;
+	}
+
+	return true;
+}
+
+static void markUIQuadsDirty(GLUIQuadList &list, uint32_t first,
+							 uint32_t count)
+{
+	list.dirtyBegin = std::min(list.dirtyBegin, first);
+	list.dirtyEnd = std::max(list.dirtyEnd, first + count);
+}
+
+void Renderer::writeUIQuads(UIQuadList list, uint32_t first, uint32_t count,
+							const glm::vec2 *positions, const glm::vec2 *sizes,
+							const glm::vec4 *colors, const Texture *textures,
+							const uint32_t *clips)
+{
+	auto *impl = mRendererImpl;
+
+	auto it = impl->uiQuadLists.find(list.id);
+	if (it == impl->uiQuadLists.end() || count == 0)
+		return;
+
+	GLUIQuadList &glList = it->second;
+	assert(first + count <= glList.textures.size());
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint32_t quad = first + i;
+
+		const GLTexture *tex =
+			reinterpret_cast<const GLTexture *>(textures[i].id);
+		glList.textures[quad] = tex;
+		glList.clips[quad] = clips[i];
+
+		if (tex && tex->loading)
+			glList.loadingQuads.push_back(quad);
+
+		// Slots are reassigned anyway if a rebatch is pending
+		uint32_t slot = 0;
+		const GLuint textureId = tex ? tex->id : impl->whiteTexture;
+		if (!glList.rebatch &&
+			!assignUIQuadSlot(glList, quad, textureId, slot))
+			glList.rebatch = true;
+
+		const glm::vec4 uv = tex ? tex->uvRect : glm::vec4(0.f, 0.f, 1.f, 1.f);
+		setUIQuad(&glList.vertices[size_t(quad) * 4], positions[i],
+				  positions[i] + sizes[i], colors[i], uv, slot);
+	}
+
+	markUIQuadsDirty(glList, first, count);
+}
+
+void Renderer::setUIClipRects(UIQuadList list, const glm::vec4 *rects,
+							  uint32_t count)
+{
+	auto it = mRendererImpl->uiQuadLists.find(list.id);
+	if (it == mRendererImpl->uiQuadLists.end())
+		return;
+
+	it->second.clipRects.assign(rects, rects + count);
+}
+
+// Groups quads into draws, in order, starting a new batch whenever the
+// textures don't fit in the slots, the clip rect changes or the batch is
+// full
+static void rebatchUIQuads(GLuint whiteTexture, GLUIQuadList &list)
+{
+	list.batches.clear();
+
+	const uint32_t quadCount = static_cast<uint32_t>(list.textures.size());
+	for (uint32_t quad = 0; quad < quadCount; ++quad)
+	{
+		const GLTexture *tex = list.textures[quad];
+		const GLuint textureId = tex ? tex->id : whiteTexture;
+
+		UIQuadBatch *batch =
+			list.batches.empty() ? nullptr : &list.batches.back();
+
+		uint32_t slot = 0;
+		if (batch)
+		{
+			while (slot < batch->textureCount &&
+				   batch->textures[slot] != textureId)
+				++slot;
+		}
+
+		if (!batch || batch->quadCount == kMaxUIQuads ||
+			slot == kUITextureSlots || batch->clip != list.clips[quad])
+		{
+			list.batches.push_back({quad, 0, {}, 0, list.clips[quad]});
+			batch = &list.batches.back();
+			slot = 0;
+		}
+
+		if (slot == batch->textureCount)
+			batch->textures[batch->textureCount++] = textureId;
+
+		batch->quadCount++;
+
+		for (uint32_t v = 0; v < 4; ++v)
+			list.vertices[size_t(quad) * 4 + v].texIndex = slot;
+	}
+
+	list.rebatch = false;
+	list.dirtyBegin = 0;
+	list.dirtyEnd = quadCount;
+}
+
+// Rewrites quads whose texture finished loading since they were written
+static void refreshLoadingUIQuads(GLUIQuadList &list)
+{
+	for (size_t i = 0; i < list.loadingQuads.size();)
+	{
+		const uint32_t quad = list.loadingQuads[i];
+		const GLTexture *tex = list.textures[quad];
+		if (tex && tex->loading)
+		{
+			++i;
+			continue;
+		}
+
+		list.loadingQuads[i] = list.loadingQuads.back();
+		list.loadingQuads.pop_back();
+
+		// Rewritten without a texture since
+		if (!tex)
+			continue;
+
+		uint32_t slot = 0;
+		if (!list.rebatch && !assignUIQuadSlot(list, quad, tex->id, slot))
+			list.rebatch = true;
+
+		UIVertex *v = &list.vertices[size_t(quad) * 4];
+		setUIQuad(v, v[0].pos, v[2].pos, v[0].color, tex->uvRect, slot);
+		markUIQuadsDirty(list, quad, 1);
+	}
+}
+
+// rect is in begin2D units with y down, GL wants pixels with y up
+static void setUIScissor(const RendererImpl *impl, glm::vec4 rect)
+{
+	const float x0 = std::floor(rect.x * impl->uiScale.x);
+	const float x1 = std::ceil((rect.x + rect.z) * impl->uiScale.x);
+	const float y0 = std::floor(rect.y * impl->uiScale.y);
+	const float y1 = std::ceil((rect.y + rect.w) * impl->uiScale.y);
+
+	const GLint *viewport = impl->uiViewport;
+	glScissor(viewport[0] + static_cast<GLint>(x0),
+			  viewport[1] + viewport[3] - static_cast<GLint>(y1),
+			  static_cast<GLsizei>(std::max(0.f, x1 - x0)),
+			  static_cast<GLsizei>(std::max(0.f, y1 - y0)));
+}
+
+void Renderer::drawUIQuadList(UIQuadList list)
+{
+	PROFILE_SCOPE("Renderer::drawUIQuadList");
+
+	auto *impl = mRendererImpl;
+
+	auto it = impl->uiQuadLists.find(list.id);
+	if (it == impl->uiQuadLists.end())
+		return;
+
+	GLUIQuadList &glList = it->second;
+
+	// Keeps the order with quads queued by drawUIQuad
+	flushUI();
+
+	refreshLoadingUIQuads(glList);
+
+	if (glList.rebatch)
+		rebatchUIQuads(impl->whiteTexture, glList);
+
+	const uint32_t quadCount = static_cast<uint32_t>(glList.textures.size());
+	if (quadCount == 0)
+		return;
+
+	// Grow the buffer, everything is uploaded into the new one
+	if (quadCount > glList.capacity)
+	{
+		glDeleteBuffers(1, &glList.vbo);
+
+		glList.capacity = std::max(quadCount, glList.capacity * 2);
+		glCreateBuffers(1, &glList.vbo);
+		glNamedBufferStorage(glList.vbo,
+							 size_t(glList.capacity) * 4 * sizeof(UIVertex),
+							 nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+		glList.dirtyBegin = 0;
+		glList.dirtyEnd = quadCount;
+	}
+
+	// Upload only what was written since the last draw
+	glList.dirtyEnd = std::min(glList.dirtyEnd, quadCount);
+	if (glList.dirtyBegin < glList.dirtyEnd)
+	{
+		const size_t quadSize = 4 * sizeof(UIVertex);
+		glNamedBufferSubData(
+			glList.vbo, static_cast<GLintptr>(glList.dirtyBegin * quadSize),
+			static_cast<GLsizeiptr>((glList.dirtyEnd - glList.dirtyBegin) *
+									quadSize),
+			&glList.vertices[size_t(glList.dirtyBegin) * 4]);
+	}
+
+	glList.dirtyBegin = UINT32_MAX;
+	glList.dirtyEnd = 0;
+
+	glVertexArrayVertexBuffer(impl->uiVao, 0, glList.vbo, 0, sizeof(UIVertex));
+
+	impl->uiProgram.set(Uniform::MVP, impl->uiProj);
+
+	impl->state.useProgram(impl->uiProgram.id);
+	impl->state.bindVertexArray(impl->uiVao);
+
+	uint32_t currentClip = 0;
+
+	for (const UIQuadBatch &batch : glList.batches)
+	{
+		if (batch.clip != currentClip)
+		{
+			if (batch.clip == 0)
+			{
+				glDisable(GL_SCISSOR_TEST);
+			}
+			else
+			{
+				if (currentClip == 0)
+					glEnable(GL_SCISSOR_TEST);
+
+				assert(batch.clip < glList.clipRects.size());
+				setUIScissor(impl, glList.clipRects[batch.clip]);
+			}
+
+			currentClip = batch.clip;
+		}
+
+		for (uint32_t i = 0; i < batch.textureCount; ++i)
+			impl->state.bindTexture(i, batch.textures[i]);
+
+		const GLsizei indexCount = static_cast<GLsizei>(batch.quadCount * 6);
+		glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT,
+								 nullptr,
+								 static_cast<GLint>(batch.firstQuad * 4));
+		impl->countDraw(indexCount / 3);
+	}
+
+	if (currentClip != 0)
+		glDisable(GL_SCISSOR_TEST);
 }
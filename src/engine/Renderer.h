@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <glm/glm.hpp>
 
+#include "Frustum.h"
+
 struct Texture
 {
 	uintptr_t id = 0;
@@ -15,7 +18,36 @@ struct Mesh
 	int64_t id = 0;
 };
 
+// Quads kept in a GPU buffer between frames, see createUIQuadList
+struct UIQuadList
+{
+	int64_t id = 0;
+};
+
+enum class RenderPass
+{
+	Scene, // beginFrame to endFrame
+	UI,	   // begin2D to end2D
+	Editor,
+	Count
+};
+
+struct RenderPassStats
+{
+	float gpuMs = 0.f; // newest finished GPU timer query, a frame or two old
+	uint32_t drawCalls = 0;
+	uint64_t triangles = 0;
+};
+
+// Objects tested against the view frustum in a frame
+struct CullStats
+{
+	uint32_t drawn = 0;
+	uint32_t culled = 0;
+};
+
 struct RendererImpl;
+struct TextureLoad;
 
 class Renderer
 {
@@ -27,11 +59,28 @@ class Renderer
 	void shutdown() noexcept;
 
 	Texture createTexture(unsigned char *data, int width, int height);
+
+	// Loads from a path are cached, loading the same path again returns
+	// the same texture/mesh and adds a reference. deleteTexture and
+	// deleteMesh drop a reference, the GL object goes with the last one.
 	Texture loadTexture(const char *path);
+
+	// Returns immediately with a handle that draws as the white texture
+	// until the image is decoded (on a job system worker) and uploaded,
+	// within a per-frame budget, by beginFrame. The handle's width/height
+	// are 0, the image size isn't known yet.
+	Texture loadTextureAsync(const char *path);
+
+	// Like loadTextureAsync, but images up to 256x256 are packed into a
+	// shared atlas page so quads using them batch together. Atlas space
+	// isn't reclaimed when the texture is deleted. Only for drawQuad and
+	// drawUIQuad, and cached apart from the other loads of the same path.
+	Texture loadAtlasTexture(const char *path);
 	void deleteTexture(Texture texture);
 
 	Mesh createQuadMesh();
 	Mesh loadMesh(const char *path);
+	void deleteMesh(Mesh mesh);
 
 	void beginFrame();
 	void endFrame();
@@ -52,6 +101,104 @@ class Renderer
 	void drawUIQuad(glm::vec2 position, glm::vec2 size, glm::vec4 color,
 					Texture texture = {});
 
+	// Retained UI quads. The vertex buffer lives on the GPU and only the
+	// quads written since the last draw are uploaded, so an unchanged list
+	// draws with one buffer bind and one draw per 8 textures it uses.
+	UIQuadList createUIQuadList();
+	void deleteUIQuadList(UIQuadList list);
+
+	// Sets the number of quads, new quads are empty until written
+	void resizeUIQuadList(UIQuadList list, uint32_t quadCount);
+
+	// Overwrites quads [first, first + count) from arrays of count entries.
+	// clips are indices into the list's clip rects, 0 draws unclipped.
+	void writeUIQuads(UIQuadList list, uint32_t first, uint32_t count,
+					  const glm::vec2 *positions, const glm::vec2 *sizes,
+					  const glm::vec4 *colors, const Texture *textures,
+					  const uint32_t *clips);
+
+	// Replaces the clip rects (x, y, width, height in begin2D units) quads
+	// are scissored to. Entry 0 is ignored, it stands for no clipping.
+	void setUIClipRects(UIQuadList list, const glm::vec4 *rects,
+						uint32_t count);
+
+	// Draws between begin2D and end2D, after the drawUIQuad calls so far.
+	// Consecutive quads with the same clip rect share one scissor.
+	void drawUIQuadList(UIQuadList list);
+
+	// Renders into an offscreen framebuffer of the given size instead of
+	// the window, for headless runs
+	bool createOffscreenTarget(int width, int height);
+
+	// Reads back what has been drawn so far this frame and writes it as PNG
+	bool saveFrame(const char *path);
+
+	// GPU timing and draw counts per pass. The renderer wraps the scene
+	// and UI passes itself, code drawing with GL directly (the editor)
+	// wraps its own and reports its draws with countDraws.
+	void beginPass(RenderPass pass);
+	void endPass(RenderPass pass);
+	void countDraws(RenderPass pass, uint32_t drawCalls, uint64_t triangles);
+
+	// Counts from the last complete frame
+	RenderPassStats passStats(RenderPass pass) const;
+
+	// View frustum of the current frame, set by beginFrame
+	const Frustum &frustum() const;
+
+	// Code culling its own objects against frustum() reports the results
+	// here, drawMesh reports itself
+	void countCulling(uint32_t drawn, uint32_t culled);
+
+	// Counts from the last complete frame
+	CullStats cullStats() const;
+
+	// Draws a tiny mesh `draws` times the way drawMesh does, once through
+	// the state cache and the uniform locations resolved at link time, once
+	// rebinding everything and looking uniforms up by name on every draw.
+	// Milliseconds including the GPU, best of several runs. Call between
+	// beginFrame and endFrame.
+	void benchDrawState(int draws, double &cachedMs, double &uncachedMs);
+
   private:
+	// Loads (cooking if needed) and uploads a mesh, bypassing the cache
+	Mesh loadMeshFile(const char *path);
+
+	// Creates the GL buffers for vertices (Vertex) and indices, indexSize
+	// is 2 or 4 bytes
+	Mesh uploadMesh(const void *vertices, uint32_t vertexCount,
+					const void *indices, uint32_t indexCount,
+					uint32_t indexSize, glm::vec3 boundsMin,
+					glm::vec3 boundsMax);
+
+	// Starts an async load, shared by loadTextureAsync and loadAtlasTexture
+	Texture startTextureLoad(const char *path, bool atlas);
+
+	// Waits for an async load loadTexture hit in the cache and uploads it
+	// now. Throws if it failed to decode, like loadTexture.
+	Texture finishTextureLoad(Texture texture);
+
+	// Uploads decoded async textures, called from beginFrame
+	void uploadTextures();
+	void uploadTexture(TextureLoad &load);
+
+	// Packs a decoded image into an atlas page, returns false if it
+	// doesn't fit in an empty page
+	bool uploadAtlasTexture(TextureLoad &load);
+
+	// Sub-allocates from the per-frame ring buffer. Returns a pointer to
+	// write to, or nullptr if this frame ran out of space. offset is where
+	// the data sits in the ring buffer, for binding.
+	void *allocateFrameData(size_t size, size_t alignment, uintptr_t &offset);
+
+	// Copies uniform block data into the ring buffer and binds it
+	void uploadUniforms(uint32_t binding, const void *data, size_t size);
+
+	// Issues the quads queued by drawQuad as instanced draws
+	void flushQuads();
+
+	// Issues the UI quads queued by drawUIQuad
+	void flushUI();
+
 	RendererImpl *mRendererImpl = nullptr;
 };
@@ -0,0 +1,101 @@
+#include "SpatialHashGrid.h"
+
+#include <cassert>
+#include <cmath>
+
+constexpr size_t kInitialBuckets = 1024;
+
+SpatialHashGrid::SpatialHashGrid(float cellSize)
+	: mCellSize(cellSize), mInvCellSize(1.f / cellSize)
+{
+	mBuckets.resize(kInitialBuckets);
+}
+
+SpatialHashGrid::Cell SpatialHashGrid::cellOf(glm::vec3 p) const
+{
+	return {static_cast<int32_t>(std::floor(p.x * mInvCellSize)),
+			static_cast<int32_t>(std::floor(p.y * mInvCellSize)),
+			static_cast<int32_t>(std::floor(p.z * mInvCellSize))};
+}
+
+uint32_t SpatialHashGrid::bucketOf(Cell cell) const
+{
+	// Primes from Teschner et al., "Optimized Spatial Hashing for Collision
+	// Detection of Deformable Objects", then mixed so the low bits the
+	// mask keeps depend on every bit of the coordinates
+	uint32_t h = uint32_t(cell.x) * 73856093u ^ uint32_t(cell.y) * 19349663u ^
+				 uint32_t(cell.z) * 83492791u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+
+	return h & static_cast<uint32_t>(mBuckets.size() - 1);
+}
+
+void SpatialHashGrid::insert(Entity *e)
+{
+	assert(e->mGridBucket == Entity::kNotInGrid);
+
+	add(e, cellOf(e->position));
+	++mCount;
+
+	// Keep about one entry per bucket
+	if (mCount > mBuckets.size())
+		grow();
+}
+
+void SpatialHashGrid::remove(Entity *e)
+{
+	if (e->mGridBucket == Entity::kNotInGrid)
+		return;
+
+	unlink(e);
+	--mCount;
+}
+
+void SpatialHashGrid::update(Entity *e)
+{
+	assert(e->mGridBucket != Entity::kNotInGrid);
+
+	const Cell cell = cellOf(e->position);
+	if (mBuckets[e->mGridBucket][e->mGridSlot].cell == cell)
+		return;
+
+	unlink(e);
+	add(e, cell);
+}
+
+void SpatialHashGrid::add(Entity *e, Cell cell)
+{
+	const uint32_t index = bucketOf(cell);
+	auto &bucket = mBuckets[index];
+
+	e->mGridBucket = index;
+	e->mGridSlot = static_cast<uint32_t>(bucket.size());
+	bucket.push_back({e, cell});
+}
+
+// Swap-and-pop out of its bucket
+void SpatialHashGrid::unlink(Entity *e)
+{
+	auto &bucket = mBuckets[e->mGridBucket];
+
+	const Entry last = bucket.back();
+	bucket[e->mGridSlot] = last;
+	last.entity->mGridSlot = e->mGridSlot;
+	bucket.pop_back();
+
+	e->mGridBucket = Entity::kNotInGrid;
+}
+
+void SpatialHashGrid::grow()
+{
+	std::vector<std::vector<Entry>> old(mBuckets.size() * 2);
+	old.swap(mBuckets);
+
+	for (const auto &bucket : old)
+	{
+		for (const Entry &entry : bucket)
+			add(entry.entity, entry.cell);
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "Entity.h"
+
+// Uniform grid of cubic cells over Entity::position, hashed into a table
+// of buckets so only occupied space costs memory. Each entity remembers
+// its bucket and slot, so insert, update and remove are O(1). Different
+// cells can share a bucket, queries check each entry's cell.
+class SpatialHashGrid
+{
+  public:
+	explicit SpatialHashGrid(float cellSize = 2.f);
+
+	void insert(Entity *e);
+	void remove(Entity *e);
+
+	// Moves e to the cell of its current position, only touches the
+	// buckets if the cell changed
+	void update(Entity *e);
+
+	size_t size() const { return mCount; }
+	float cellSize() const { return mCellSize; }
+
+	// Calls fn(Entity *) for every entity within radius of center
+	template <typename F>
+	void queryRadius(glm::vec3 center, float radius, F &&fn) const
+	{
+		const float radiusSq = radius * radius;
+		forEachEntry(center - glm::vec3(radius), center + glm::vec3(radius),
+					 [&](const Entry &entry)
+					 {
+						 const glm::vec3 d = entry.entity->position - center;
+						 if (glm::dot(d, d) <= radiusSq)
+							 fn(entry.entity);
+					 });
+	}
+
+	// Calls fn(Entity *) for every entity inside the box
+	template <typename F>
+	void queryAabb(glm::vec3 min, glm::vec3 max, F &&fn) const
+	{
+		forEachEntry(min, max,
+					 [&](const Entry &entry)
+					 {
+						 const glm::vec3 &p = entry.entity->position;
+						 if (p.x >= min.x && p.y >= min.y && p.z >= min.z &&
+							 p.x <= max.x && p.y <= max.y && p.z <= max.z)
+							 fn(entry.entity);
+					 });
+	}
+
+  private:
+	struct Cell
+	{
+		int32_t x, y, z;
+
+		bool operator==(const Cell &o) const
+		{
+			return x == o.x && y == o.y && z == o.z;
+		}
+	};
+
+	struct Entry
+	{
+		Entity *entity;
+		Cell cell; // where it was filed, position may have moved since
+	};
+
+	Cell cellOf(glm::vec3 p) const;
+	uint32_t bucketOf(Cell cell) const;
+
+	void add(Entity *e, Cell cell);
+	void unlink(Entity *e);
+	void grow();
+
+	// Calls fn(entry) once for each entry filed in a cell overlapping the
+	// box. Entries still need testing against the box itself.
+	template <typename F>
+	void forEachEntry(glm::vec3 min, glm::vec3 max, F &&fn) const
+	{
+		const Cell lo = cellOf(min);
+		const Cell hi = cellOf(max);
+
+		const uint64_t cells = uint64_t(hi.x - lo.x + 1) *
+							   uint64_t(hi.y - lo.y + 1) *
+							   uint64_t(hi.z - lo.z + 1);
+
+		// Big boxes cover more cells than there are buckets, walking
+		// every entry once is cheaper
+		if (cells > mBuckets.size())
+		{
+			for (const auto &bucket : mBuckets)
+			{
+				for (const Entry &entry : bucket)
+				{
+					const Cell &c = entry.cell;
+					if (c.x >= lo.x && c.y >= lo.y && c.z >= lo.z &&
+						c.x <= hi.x && c.y <= hi.y && c.z <= hi.z)
+						fn(entry);
+				}
+			}
+			return;
+		}
+
+		for (int32_t z = lo.z; z <= hi.z; ++z)
+		{
+			for (int32_t y = lo.y; y <= hi.y; ++y)
+			{
+				for (int32_t x = lo.x; x <= hi.x; ++x)
+				{
+					const Cell cell{x, y, z};
+					for (const Entry &entry : mBuckets[bucketOf(cell)])
+					{
+						// Skips other cells hashed to the same bucket, so
+						// nothing is reported twice
+						if (entry.cell == cell)
+							fn(entry);
+					}
+				}
+			}
+		}
+	}
+
+	float mCellSize;
+	float mInvCellSize;
+
+	std::vector<std::vector<Entry>> mBuckets; // power of two
+	size_t mCount = 0;
+};
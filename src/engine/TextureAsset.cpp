@@ -0,0 +1,567 @@
+#include "TextureAsset.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// One 4x4 block of RGBA8 texels, row by row
+using Block = uint8_t[16 * 4];
+
+static void readBlock(const uint8_t *rgba, uint32_t width, uint32_t height,
+					  uint32_t blockX, uint32_t blockY, Block &block)
+{
+	for (uint32_t y = 0; y < 4; ++y)
+	{
+		const uint32_t srcY = std::min(blockY * 4 + y, height - 1);
+		for (uint32_t x = 0; x < 4; ++x)
+		{
+			const uint32_t srcX = std::min(blockX * 4 + x, width - 1);
+			memcpy(&block[(y * 4 + x) * 4],
+				   &rgba[(size_t(srcY) * width + srcX) * 4], 4);
+		}
+	}
+}
+
+static uint16_t to565(const float color[3])
+{
+	auto quantize = [](float v, int max)
+	{ return std::clamp(int(v * max / 255.f + 0.5f), 0, max); };
+
+	return uint16_t(quantize(color[0], 31) << 11 |
+					quantize(color[1], 63) << 5 | quantize(color[2], 31));
+}
+
+static void from565(uint16_t packed, float color[3])
+{
+	const int r = (packed >> 11) & 31;
+	const int g = (packed >> 5) & 63;
+	const int b = packed & 31;
+
+	// Same bit replication the GPU does
+	color[0] = float(r << 3 | r >> 2);
+	color[1] = float(g << 2 | g >> 4);
+	color[2] = float(b << 3 | b >> 2);
+}
+
+// Weight of endpoint 0 for each 4-colour mode index
+constexpr float kColorWeights[4] = {1.f, 0.f, 2.f / 3.f, 1.f / 3.f};
+
+// Picks the nearest palette entry for each texel, returns the squared
+// error and the 2-bit indices packed in texel order
+static float fitIndices(const Block &block, uint16_t c0, uint16_t c1,
+						uint32_t &indices)
+{
+	float e0[3], e1[3];
+	from565(c0, e0);
+	from565(c1, e1);
+
+	float palette[4][3];
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int c = 0; c < 3; ++c)
+			palette[i][c] =
+				kColorWeights[i] * e0[c] + (1.f - kColorWeights[i]) * e1[c];
+	}
+
+	float error = 0.f;
+	indices = 0;
+	for (int t = 0; t < 16; ++t)
+	{
+		const uint8_t *px = &block[t * 4];
+
+		int best = 0;
+		float bestDist = INFINITY;
+		for (int i = 0; i < 4; ++i)
+		{
+			const float dr = px[0] - palette[i][0];
+			const float dg = px[1] - palette[i][1];
+			const float db = px[2] - palette[i][2];
+			const float dist = dr * dr + dg * dg + db * db;
+			if (dist < bestDist)
+			{
+				bestDist = dist;
+				best = i;
+			}
+		}
+
+		error += bestDist;
+		indices |= uint32_t(best) << (t * 2);
+	}
+
+	return error;
+}
+
+// Least squares endpoints for a given set of indices, false if every
+// texel uses the same weight
+static bool refineEndpoints(const Block &block, uint32_t indices, float e0[3],
+							float e1[3])
+{
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	float x0[3] = {}, x1[3] = {};
+
+	for (int t = 0; t < 16; ++t)
+	{
+		const float w = kColorWeights[(indices >> (t * 2)) & 3];
+		aa += w * w;
+		ab += w * (1.f - w);
+		bb += (1.f - w) * (1.f - w);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			x0[c] += w * block[t * 4 + c];
+			x1[c] += (1.f - w) * block[t * 4 + c];
+		}
+	}
+
+	const float det = aa * bb - ab * ab;
+	if (std::abs(det) < 1e-6f)
+		return false;
+
+	for (int c = 0; c < 3; ++c)
+	{
+		e0[c] = std::clamp((bb * x0[c] - ab * x1[c]) / det, 0.f, 255.f);
+		e1[c] = std::clamp((aa * x1[c] - ab * x0[c]) / det, 0.f, 255.f);
+	}
+
+	return true;
+}
+
+// BC1 colour block: endpoints from the extremes along the principal axis
+// of the texel colours, then a couple of least squares refinements
+static void encodeColorBlock(const Block &block, uint8_t *out)
+{
+	float mean[3] = {};
+	for (int t = 0; t < 16; ++t)
+	{
+		for (int c = 0; c < 3; ++c)
+			mean[c] += block[t * 4 + c];
+	}
+	for (float &m : mean)
+		m /= 16.f;
+
+	float cov[6] = {}; // rr rg rb gg gb bb
+	for (int t = 0; t < 16; ++t)
+	{
+		const float r = block[t * 4 + 0] - mean[0];
+		const float g = block[t * 4 + 1] - mean[1];
+		const float b = block[t * 4 + 2] - mean[2];
+		cov[0] += r * r;
+		cov[1] += r * g;
+		cov[2] += r * b;
+		cov[3] += g * g;
+		cov[4] += g * b;
+		cov[5] += b * b;
+	}
+
+	// Power iteration, starting along the grey diagonal
+	float axis[3] = {1.f, 1.f, 1.f};
+	for (int i = 0; i < 8; ++i)
+	{
+		const float next[3] = {
+			cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+			cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+			cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+		};
+
+		const float length = std::max(
+			{std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+		if (length < 1e-6f)
+			break; // flat colour, any axis will do
+
+		for (int c = 0; c < 3; ++c)
+			axis[c] = next[c] / length;
+	}
+
+	int minTexel = 0, maxTexel = 0;
+	float minDot = INFINITY, maxDot = -INFINITY;
+	for (int t = 0; t < 16; ++t)
+	{
+		const float d = block[t * 4 + 0] * axis[0] +
+						block[t * 4 + 1] * axis[1] + block[t * 4 + 2] * axis[2];
+		if (d < minDot)
+		{
+			minDot = d;
+			minTexel = t;
+		}
+		if (d > maxDot)
+		{
+			maxDot = d;
+			maxTexel = t;
+		}
+	}
+
+	float e0[3], e1[3];
+	for (int c = 0; c < 3; ++c)
+	{
+		e0[c] = block[maxTexel * 4 + c];
+		e1[c] = block[minTexel * 4 + c];
+	}
+
+	uint16_t c0 = to565(e0);
+	uint16_t c1 = to565(e1);
+	uint32_t indices;
+	float error = fitIndices(block, c0, c1, indices);
+
+	for (int i = 0; i < 2 && error > 0.f; ++i)
+	{
+		if (!refineEndpoints(block, indices, e0, e1))
+			break;
+
+		const uint16_t r0 = to565(e0);
+		const uint16_t r1 = to565(e1);
+		uint32_t refined;
+		const float refinedError = fitIndices(block, r0, r1, refined);
+		if (refinedError >= error)
+			break;
+
+		c0 = r0;
+		c1 = r1;
+		indices = refined;
+		error = refinedError;
+	}
+
+	// Four colour mode needs c0 > c1, swapping endpoints flips each index's
+	// low bit (0 <-> 1, 2 <-> 3)
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		indices ^= 0x55555555;
+	}
+	else if (c0 == c1)
+	{
+		indices = 0;
+	}
+
+	out[0] = uint8_t(c0);
+	out[1] = uint8_t(c0 >> 8);
+	out[2] = uint8_t(c1);
+	out[3] = uint8_t(c1 >> 8);
+	for (int i = 0; i < 4; ++i)
+		out[4 + i] = uint8_t(indices >> (i * 8));
+}
+
+// BC3 alpha block: the block's alpha range split into 8 steps
+static void encodeAlphaBlock(const Block &block, uint8_t *out)
+{
+	uint8_t a0 = 0, a1 = 255;
+	for (int t = 0; t < 16; ++t)
+	{
+		a0 = std::max(a0, block[t * 4 + 3]);
+		a1 = std::min(a1, block[t * 4 + 3]);
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+
+	uint64_t indices = 0;
+	if (a0 > a1)
+	{
+		// a0 > a1 selects 8 alpha mode: a0, a1, then 6 steps from a0 to a1
+		int palette[8] = {a0, a1};
+		for (int i = 2; i < 8; ++i)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+
+		for (int t = 0; t < 16; ++t)
+		{
+			const int alpha = block[t * 4 + 3];
+
+			int best = 0;
+			for (int i = 1; i < 8; ++i)
+			{
+				if (std::abs(palette[i] - alpha) <
+					std::abs(palette[best] - alpha))
+					best = i;
+			}
+
+			indices |= uint64_t(best) << (t * 3);
+		}
+	}
+
+	for (int i = 0; i < 6; ++i)
+		out[2 + i] = uint8_t(indices >> (i * 8));
+}
+
+static float srgbToLinear(uint8_t value)
+{
+	static const auto table = []
+	{
+		std::vector<float> t(256);
+		for (int i = 0; i < 256; ++i)
+		{
+			const float v = i / 255.f;
+			t[i] = v <= 0.04045f ? v / 12.92f
+								 : std::pow((v + 0.055f) / 1.055f, 2.4f);
+		}
+		return t;
+	}();
+
+	return table[value];
+}
+
+static uint8_t linearToSrgb(float value)
+{
+	const float v = value <= 0.0031308f
+						? value * 12.92f
+						: 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+	return uint8_t(std::clamp(v * 255.f + 0.5f, 0.f, 255.f));
+}
+
+// Next mip down, a 2x2 box filter with colour averaged in linear light
+static std::vector<uint8_t> downsample(const std::vector<uint8_t> &rgba,
+									   uint32_t width, uint32_t height)
+{
+	const uint32_t mipWidth = std::max(1u, width / 2);
+	const uint32_t mipHeight = std::max(1u, height / 2);
+	std::vector<uint8_t> mip(size_t(mipWidth) * mipHeight * 4);
+
+	for (uint32_t y = 0; y < mipHeight; ++y)
+	{
+		const uint32_t y0 = std::min(y * 2, height - 1);
+		const uint32_t y1 = std::min(y * 2 + 1, height - 1);
+
+		for (uint32_t x = 0; x < mipWidth; ++x)
+		{
+			const uint32_t x0 = std::min(x * 2, width - 1);
+			const uint32_t x1 = std::min(x * 2 + 1, width - 1);
+
+			const uint8_t *src[4] = {
+				&rgba[(size_t(y0) * width + x0) * 4],
+				&rgba[(size_t(y0) * width + x1) * 4],
+				&rgba[(size_t(y1) * width + x0) * 4],
+				&rgba[(size_t(y1) * width + x1) * 4],
+			};
+
+			uint8_t *dst = &mip[(size_t(y) * mipWidth + x) * 4];
+			for (int c = 0; c < 3; ++c)
+			{
+				float sum = 0.f;
+				for (const uint8_t *s : src)
+					sum += srgbToLinear(s[c]);
+				dst[c] = linearToSrgb(sum * 0.25f);
+			}
+
+			const int alpha = src[0][3] + src[1][3] + src[2][3] + src[3][3];
+			dst[3] = uint8_t((alpha + 2) / 4);
+		}
+	}
+
+	return mip;
+}
+
+size_t compressedMipSize(TextureFormat format, uint32_t width, uint32_t height)
+{
+	const size_t blocks = size_t((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (format == TextureFormat::BC1 ? 8 : 16);
+}
+
+void compressBC1(const uint8_t *rgba, uint32_t width, uint32_t height,
+				 uint8_t *out)
+{
+	Block block;
+	for (uint32_t by = 0; by < (height + 3) / 4; ++by)
+	{
+		for (uint32_t bx = 0; bx < (width + 3) / 4; ++bx)
+		{
+			readBlock(rgba, width, height, bx, by, block);
+			encodeColorBlock(block, out);
+			out += 8;
+		}
+	}
+}
+
+void compressBC3(const uint8_t *rgba, uint32_t width, uint32_t height,
+				 uint8_t *out)
+{
+	Block block;
+	for (uint32_t by = 0; by < (height + 3) / 4; ++by)
+	{
+		for (uint32_t bx = 0; bx < (width + 3) / 4; ++bx)
+		{
+			readBlock(rgba, width, height, bx, by, block);
+			encodeAlphaBlock(block, out);
+			encodeColorBlock(block, out + 8);
+			out += 16;
+		}
+	}
+}
+
+std::string cookedTexturePath(const char *sourcePath)
+{
+	return std::filesystem::path(sourcePath).replace_extension(".tex").string();
+}
+
+bool textureNeedsCooking(const char *sourcePath, const char *cookedPath)
+{
+	std::error_code ec;
+
+	const auto cookedTime = std::filesystem::last_write_time(cookedPath, ec);
+	if (ec)
+		return true;
+
+	// No source (shipped cooked only), use what we have
+	const auto sourceTime = std::filesystem::last_write_time(sourcePath, ec);
+	if (ec)
+		return false;
+
+	return sourceTime > cookedTime;
+}
+
+bool writeCookedTexture(const char *path, const uint8_t *rgba,
+						uint32_t width, uint32_t height)
+{
+	if (width == 0 || height == 0)
+		return false;
+
+	const size_t texels = size_t(width) * height;
+
+	bool opaque = true;
+	for (size_t i = 0; i < texels && opaque; ++i)
+		opaque = rgba[i * 4 + 3] == 255;
+
+	const TextureFormat format =
+		opaque ? TextureFormat::BC1 : TextureFormat::BC3;
+
+	TextureFileHeader header{};
+	header.magic = TextureFileHeader::kMagic;
+	header.version = TextureFileHeader::kVersion;
+	header.format = static_cast<uint32_t>(format);
+	header.width = width;
+	header.height = height;
+
+	std::vector<TextureMip> mips;
+	uint32_t offset = static_cast<uint32_t>(
+		sizeof(header) + TextureFileHeader::kMaxMips * sizeof(TextureMip));
+	uint32_t w = width, h = height;
+	while (true)
+	{
+		TextureMip mip;
+		mip.width = w;
+		mip.height = h;
+		mip.offset = offset;
+		mip.size = static_cast<uint32_t>(compressedMipSize(format, w, h));
+		mips.push_back(mip);
+		offset += mip.size;
+
+		if ((w == 1 && h == 1) || mips.size() == TextureFileHeader::kMaxMips)
+			break;
+
+		w = std::max(1u, w / 2);
+		h = std::max(1u, h / 2);
+	}
+	header.mipCount = static_cast<uint32_t>(mips.size());
+
+	// Fixed size mip table so data offsets don't depend on the count
+	mips.resize(TextureFileHeader::kMaxMips, TextureMip{});
+
+	// Write to a temporary and rename so a crash never leaves a partial
+	// file that looks up to date
+	const std::string tempPath = std::string(path) + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char *>(mips.data()),
+				   mips.size() * sizeof(TextureMip));
+
+		std::vector<uint8_t> level(rgba, rgba + texels * 4);
+		std::vector<uint8_t> blocks;
+
+		for (uint32_t i = 0; i < header.mipCount; ++i)
+		{
+			const TextureMip &mip = mips[i];
+			if (i > 0)
+				level = downsample(level, mips[i - 1].width,
+								   mips[i - 1].height);
+
+			blocks.resize(mip.size);
+			if (format == TextureFormat::BC1)
+				compressBC1(level.data(), mip.width, mip.height, blocks.data());
+			else
+				compressBC3(level.data(), mip.width, mip.height, blocks.data());
+
+			file.write(reinterpret_cast<const char *>(blocks.data()),
+					   blocks.size());
+		}
+
+		if (!file.good())
+			return false;
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tempPath, path, ec);
+	return !ec;
+}
+
+bool cookTexture(const char *sourcePath, const char *cookedPath)
+{
+	int width, height, channels;
+	stbi_set_flip_vertically_on_load_thread(true);
+	unsigned char *pixels =
+		stbi_load(sourcePath, &width, &height, &channels, 4);
+	if (!pixels)
+		return false;
+
+	const bool written = writeCookedTexture(cookedPath, pixels, width, height);
+	stbi_image_free(pixels);
+	return written;
+}
+
+bool CookedTexture::open(const char *path)
+{
+	mHeader = nullptr;
+	mMips = nullptr;
+
+	if (!mFile.open(path))
+		return false;
+
+	const size_t tableEnd = sizeof(TextureFileHeader) +
+							TextureFileHeader::kMaxMips * sizeof(TextureMip);
+	if (mFile.size() < tableEnd)
+		return false;
+
+	const auto *header =
+		reinterpret_cast<const TextureFileHeader *>(mFile.data());
+	const auto format = static_cast<TextureFormat>(header->format);
+	if (header->magic != TextureFileHeader::kMagic ||
+		header->version != TextureFileHeader::kVersion ||
+		(format != TextureFormat::BC1 && format != TextureFormat::BC3) ||
+		header->mipCount == 0 ||
+		header->mipCount > TextureFileHeader::kMaxMips)
+	{
+		std::cerr << path << ": unsupported cooked texture" << std::endl;
+		return false;
+	}
+
+	const auto *mips = reinterpret_cast<const TextureMip *>(
+		mFile.data() + sizeof(TextureFileHeader));
+	for (uint32_t i = 0; i < header->mipCount; ++i)
+	{
+		const TextureMip &mip = mips[i];
+		if (mip.size != compressedMipSize(format, mip.width, mip.height) ||
+			size_t(mip.offset) + mip.size > mFile.size())
+		{
+			std::cerr << path << ": truncated cooked texture" << std::endl;
+			return false;
+		}
+	}
+
+	mHeader = header;
+	mMips = mips;
+	return true;
+}
+
+size_t CookedTexture::dataSize() const
+{
+	size_t size = 0;
+	for (uint32_t i = 0; i < mHeader->mipCount; ++i)
+		size += mMips[i].size;
+	return size;
+}
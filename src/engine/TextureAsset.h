@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "MappedFile.h"
+
+// Block compressed formats the cooker writes, both in 4x4 texel blocks
+enum class TextureFormat : uint32_t
+{
+	BC1 = 1, // RGB, 8 bytes per block
+	BC3 = 3, // RGBA, 16 bytes per block (BC1 colour plus interpolated alpha)
+};
+
+// Cooked texture file layout, native endianness:
+//   TextureFileHeader
+//   TextureMip mips[mipCount]
+//   block data for each mip, largest first
+struct TextureFileHeader
+{
+	static constexpr uint32_t kMagic = 0x43584554; // "TEXC"
+	static constexpr uint32_t kVersion = 1;
+	static constexpr uint32_t kMaxMips = 16;
+
+	uint32_t magic;
+	uint32_t version;
+	uint32_t format; // TextureFormat
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipCount; // full chain down to 1x1
+};
+
+struct TextureMip
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t offset; // from the start of the file
+	uint32_t size;
+};
+
+// Bytes of block data for one mip of the given size
+size_t compressedMipSize(TextureFormat format, uint32_t width, uint32_t height);
+
+// Compresses RGBA8 pixels, edge blocks are padded by repeating the last
+// row/column. out must hold compressedMipSize bytes.
+void compressBC1(const uint8_t *rgba, uint32_t width, uint32_t height,
+				 uint8_t *out);
+void compressBC3(const uint8_t *rgba, uint32_t width, uint32_t height,
+				 uint8_t *out);
+
+// Where the cooked version of a source image lives, next to it with a
+// .tex extension
+std::string cookedTexturePath(const char *sourcePath);
+
+// True if the cooked file is missing or older than the source
+bool textureNeedsCooking(const char *sourcePath, const char *cookedPath);
+
+// Generates the mip chain (filtered in linear light) and compresses it,
+// BC1 if the image is opaque and BC3 otherwise
+bool writeCookedTexture(const char *path, const uint8_t *rgba,
+						uint32_t width, uint32_t height);
+
+// Loads an image (flipped for GL, like the renderer's loads) and cooks it
+bool cookTexture(const char *sourcePath, const char *cookedPath);
+
+// A cooked texture mapped into memory, mip data points straight into the
+// file
+class CookedTexture
+{
+  public:
+	// Returns false if the file is missing, truncated or from another
+	// version
+	bool open(const char *path);
+
+	bool isOpen() const { return mHeader != nullptr; }
+
+	const TextureFileHeader &header() const { return *mHeader; }
+	TextureFormat format() const
+	{
+		return static_cast<TextureFormat>(mHeader->format);
+	}
+
+	const TextureMip &mip(uint32_t level) const { return mMips[level]; }
+	const uint8_t *mipData(uint32_t level) const
+	{
+		return mFile.data() + mMips[level].offset;
+	}
+
+	// Block data of every mip, what ends up in VRAM
+	size_t dataSize() const;
+
+  private:
+	MappedFile mFile;
+	const TextureFileHeader *mHeader = nullptr;
+	const TextureMip *mMips = nullptr;
+};
@@ -3,6 +3,9 @@
 #include "../Editor.h"
 #include "../Engine.h"
 #include "../IconsMaterialSymbols.h"
+#include "../Profiler.h"
+
+#include <algorithm>
 
 #if WITH_EDITOR
 #include <imgui.h>
@@ -16,6 +19,13 @@ class UIInspector : public EditorTool
 
 	void draw() override
 	{
+		ImGui::Text("Layout: %u measured, %u arranged, %u rendered, "
+					"%u clipped",
+					UIElement::layoutStats.measured,
+					UIElement::layoutStats.arranged,
+					UIElement::layoutStats.rendered,
+					UIElement::layoutStats.clipped);
+
 		ImGui::BeginChild("Layout Tree", ImVec2(0, 0));
 		drawTree2(mRootPanel);
 		ImGui::EndChild();
@@ -115,8 +125,12 @@ class UIInspector : public EditorTool
 
 				ImGui::SameLine(columnWidth);
 
+				float tmpWidth = element->GetWidth();
 				ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
-				ImGui::DragFloat("##Width", &element->width);
+				if (ImGui::DragFloat("##Width", &tmpWidth))
+				{
+					element->SetWidth(tmpWidth);
+				}
 
 				ImGui::EndGroup();
 			}
@@ -132,8 +146,12 @@ class UIInspector : public EditorTool
 
 				ImGui::SameLine(columnWidth);
 
+				float tmpHeight = element->GetHeight();
 				ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
-				ImGui::DragFloat("##Height", &element->height);
+				if (ImGui::DragFloat("##Height", &tmpHeight))
+				{
+					element->SetHeight(tmpHeight);
+				}
 
 				ImGui::EndGroup();
 			}
@@ -143,26 +161,37 @@ class UIInspector : public EditorTool
 			{
 				ImGui::Text("Margin");
 
+				Thickness tmpMargin = element->GetMargin();
+				bool marginChanged = false;
+
 				float startX = ImGui::GetCursorPosX();
 				ImGui::SameLine(columnWidth);
 
 				ImGui::SetNextItemWidth(40.0f);
-				ImGui::DragFloat(ICON_MS_BORDER_LEFT, &element->margin.left,
-								 1.f, 0.f, 0.f, "%.0f");
+				marginChanged |=
+					ImGui::DragFloat(ICON_MS_BORDER_LEFT, &tmpMargin.left, 1.f,
+									 0.f, 0.f, "%.0f");
 				ImGui::SameLine();
 				ImGui::SetNextItemWidth(40.0f);
-				ImGui::DragFloat(ICON_MS_BORDER_RIGHT, &element->margin.right,
-								 1.f, 0.f, 0.f, "%.0f");
+				marginChanged |=
+					ImGui::DragFloat(ICON_MS_BORDER_RIGHT, &tmpMargin.right,
+									 1.f, 0.f, 0.f, "%.0f");
 
 				ImGui::SetCursorPosX(startX + columnWidth);
 
 				ImGui::SetNextItemWidth(40.0f);
-				ImGui::DragFloat(ICON_MS_BORDER_TOP, &element->margin.top, 1.f,
-								 0.f, 0.f, "%.0f");
+				marginChanged |= ImGui::DragFloat(
+					ICON_MS_BORDER_TOP, &tmpMargin.top, 1.f, 0.f, 0.f, "%.0f");
 				ImGui::SameLine();
 				ImGui::SetNextItemWidth(40.0f);
-				ImGui::DragFloat(ICON_MS_BORDER_BOTTOM, &element->margin.bottom,
-								 1.f, 0.f, 0.f, "%.0f");
+				marginChanged |=
+					ImGui::DragFloat(ICON_MS_BORDER_BOTTOM, &tmpMargin.bottom,
+									 1.f, 0.f, 0.f, "%.0f");
+
+				if (marginChanged)
+				{
+					element->SetMargin(tmpMargin);
+				}
 
 				ImGui::EndGroup();
 			}
@@ -174,10 +203,10 @@ class UIInspector : public EditorTool
 				ImGui::PushStyleVar(ImGuiStyleVar_SelectableTextAlign,
 									ImVec2(0.5f, 0.5f));
 				if (ImGui::Selectable(
-						label, element->horizontalAlignment == hAlign,
+						label, element->GetHorizontalAlignment() == hAlign,
 						ImGuiSelectableFlags_None, ImVec2(15, 15)))
 				{
-					element->horizontalAlignment = hAlign;
+					element->SetHorizontalAlignment(hAlign);
 				}
 				ImGui::PopStyleVar();
 			};
@@ -210,10 +239,10 @@ class UIInspector : public EditorTool
 				ImGui::PushStyleVar(ImGuiStyleVar_SelectableTextAlign,
 									ImVec2(0.5f, 0.5f));
 				if (ImGui::Selectable(
-						label, element->verticalAlignment == vAlign,
+						label, element->GetVerticalAlignment() == vAlign,
 						ImGuiSelectableFlags_None, ImVec2(15, 15)))
 				{
-					element->verticalAlignment = vAlign;
+					element->SetVerticalAlignment(vAlign);
 				}
 				ImGui::PopStyleVar();
 			};
@@ -241,14 +270,14 @@ class UIInspector : public EditorTool
 
 			// Canvas attached properties
 			if (auto *owningCanvas =
-					dynamic_cast<Canvas *>(element->owningPanel))
+					dynamic_cast<Canvas *>(element->parent))
 			{
 				ImGui::BeginGroup();
 				{
 					ImGui::Text("Canvas Left");
 					ImGui::SameLine(columnWidth);
 
-					float tmpCanvasLeft = owningCanvas->mSlots[element].left;
+					float tmpCanvasLeft = owningCanvas->GetLeft(element);
 					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
 					if (ImGui::DragFloat("##Canvas Left", &tmpCanvasLeft))
 					{
@@ -258,7 +287,7 @@ class UIInspector : public EditorTool
 					ImGui::Text("Canvas Top");
 					ImGui::SameLine(columnWidth);
 
-					float tmpCanvasTop = owningCanvas->mSlots[element].top;
+					float tmpCanvasTop = owningCanvas->GetTop(element);
 					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
 					if (ImGui::DragFloat("##Canvas Top", &tmpCanvasTop))
 					{
@@ -268,7 +297,7 @@ class UIInspector : public EditorTool
 					ImGui::Text("Canvas Right");
 					ImGui::SameLine(columnWidth);
 
-					float tmpCanvasRight = owningCanvas->mSlots[element].right;
+					float tmpCanvasRight = owningCanvas->GetRight(element);
 					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
 					if (ImGui::DragFloat("##Canvas Right", &tmpCanvasRight))
 					{
@@ -278,8 +307,7 @@ class UIInspector : public EditorTool
 					ImGui::Text("Canvas Bottom");
 					ImGui::SameLine(columnWidth);
 
-					float tmpCanvasBottom =
-						owningCanvas->mSlots[element].bottom;
+					float tmpCanvasBottom = owningCanvas->GetBottom(element);
 					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
 					if (ImGui::DragFloat("##Canvas Bottom", &tmpCanvasBottom))
 					{
@@ -301,12 +329,13 @@ class UIInspector : public EditorTool
 					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
 
 					const char *items[] = {"Horizontal", "Vertical"};
-					int orientationTmp = static_cast<int>(stackPanel->orientation);
+					int orientationTmp =
+						static_cast<int>(stackPanel->GetOrientation());
 					if (ImGui::Combo("##Orientation", &orientationTmp, items,
 									 IM_ARRAYSIZE(items)))
 					{
-						stackPanel->orientation =
-							static_cast<Orientation>(orientationTmp);
+						stackPanel->SetOrientation(
+							static_cast<Orientation>(orientationTmp));
 					}
 
 					ImGui::EndGroup();
@@ -317,8 +346,49 @@ class UIInspector : public EditorTool
 					ImGui::Text("Spacing");
 					ImGui::SameLine(columnWidth);
 
+					float tmpSpacing = stackPanel->GetSpacing();
+					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+					if (ImGui::DragFloat("##Spacing", &tmpSpacing))
+					{
+						stackPanel->SetSpacing(tmpSpacing);
+					}
+
+					ImGui::EndGroup();
+				}
+			}
+
+			// Virtualizing stack panel
+			if (auto *virtualizing =
+					dynamic_cast<VirtualizingStackPanel *>(element))
+			{
+				ImGui::BeginGroup();
+				{
+					ImGui::Text("Scroll Offset");
+					ImGui::SameLine(columnWidth);
+
+					double tmpScrollOffset = virtualizing->GetScrollOffset();
+					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
+					if (ImGui::DragScalar("##Scroll Offset",
+										  ImGuiDataType_Double,
+										  &tmpScrollOffset))
+					{
+						virtualizing->SetScrollOffset(tmpScrollOffset);
+					}
+
+					ImGui::Text("Item Extent");
+					ImGui::SameLine(columnWidth);
+
+					float tmpItemExtent = virtualizing->GetItemExtent();
 					ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
-					ImGui::DragFloat("##Spacing", &stackPanel->spacing);
+					if (ImGui::DragFloat("##Item Extent", &tmpItemExtent))
+					{
+						virtualizing->SetItemExtent(tmpItemExtent);
+					}
+
+					ImGui::Text("Realized %zu to %zu of %zu",
+								virtualizing->GetFirstRealizedItem(),
+								virtualizing->GetLastRealizedItem(),
+								virtualizing->GetItemCount());
 
 					ImGui::EndGroup();
 				}
@@ -335,10 +405,23 @@ class UIInspector : public EditorTool
 				ImGui::Text("Background");
 				ImGui::SameLine(columnWidth);
 
+				glm::vec4 tmpBackground = panel->GetBackground();
 				ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x);
-				ImGui::ColorEdit4("##Background", (float *)&panel->background,
-								  ImGuiColorEditFlags_NoInputs |
-									  ImGuiColorEditFlags_NoLabel);
+				if (ImGui::ColorEdit4("##Background", (float *)&tmpBackground,
+									  ImGuiColorEditFlags_NoInputs |
+										  ImGuiColorEditFlags_NoLabel))
+				{
+					panel->SetBackground(tmpBackground);
+				}
+
+				ImGui::Text("Clip To Bounds");
+				ImGui::SameLine(columnWidth);
+
+				bool tmpClipToBounds = panel->GetClipToBounds();
+				if (ImGui::Checkbox("##Clip To Bounds", &tmpClipToBounds))
+				{
+					panel->SetClipToBounds(tmpClipToBounds);
+				}
 
 				ImGui::EndGroup();
 			}
@@ -349,52 +432,602 @@ class UIInspector : public EditorTool
 };
 #endif
 
-void FrameworkElement::Measure(Size availableSize)
+LayoutStats UIElement::layoutStats;
+
+void UIElement::Measure(Size availableSize)
+{
+	if (!mMeasureDirty && availableSize == mPreviousAvailableSize)
+		return;
+
+	const Size previousDesiredSize = desiredSize;
+
+	++layoutStats.measured;
+	MeasureCore(availableSize);
+
+	mMeasureDirty = false;
+	mPreviousAvailableSize = availableSize;
+
+	// Arranging depends on desiredSize, not just on the final rect. Goes
+	// through InvalidateArrange so the ancestors are dirty too.
+	if (desiredSize != previousDesiredSize)
+		InvalidateArrange();
+}
+
+void UIElement::Arrange(Rect finalRect)
+{
+	if (!mArrangeDirty && finalRect == mPreviousFinalRect)
+		return;
+
+	const Rect previousLayoutRect = layoutRect;
+
+	++layoutStats.arranged;
+	ArrangeCore(finalRect);
+
+	mArrangeDirty = false;
+	mPreviousFinalRect = finalRect;
+
+	if (layoutRect != previousLayoutRect)
+		InvalidateRender();
+}
+
+void UIElement::InvalidateMeasure()
+{
+	for (UIElement *e = this; e && !e->mMeasureDirty; e = e->parent)
+	{
+		e->mMeasureDirty = true;
+		e->mArrangeDirty = true;
+	}
+}
+
+void UIElement::InvalidateArrange()
+{
+	for (UIElement *e = this; e && !e->mArrangeDirty; e = e->parent)
+	{
+		e->mArrangeDirty = true;
+	}
+}
+
+void UIElement::InvalidateRender()
+{
+	mRenderDirty = true;
+	for (UIElement *e = this; e && !e->mSubtreeRenderDirty; e = e->parent)
+	{
+		e->mSubtreeRenderDirty = true;
+	}
+}
+
+void UIElement::InvalidateRenderStructure()
+{
+	for (UIElement *e = this; e && !e->mRenderStructureDirty; e = e->parent)
+	{
+		e->mRenderStructureDirty = true;
+	}
+}
+
+void UIElement::UpdateRenderList(UIRenderList &list)
+{
+	if (mRenderStructureDirty)
+	{
+		list.Clear();
+		AppendQuads(list);
+	}
+	else if (mSubtreeRenderDirty)
+	{
+		RefreshQuads(list);
+	}
+}
+
+void UIElement::AppendQuads(UIRenderList &list)
+{
+	mFirstQuad = list.Allocate(GetQuadCount());
+	WriteQuadsClipped(list);
+
+	mRenderDirty = false;
+	mSubtreeRenderDirty = false;
+	mRenderStructureDirty = false;
+}
+
+void UIElement::RefreshQuads(UIRenderList &list)
+{
+	if (mRenderDirty)
+	{
+		WriteQuadsClipped(list);
+		mRenderDirty = false;
+	}
+
+	mSubtreeRenderDirty = false;
+}
+
+void UIElement::InvalidateRenderSubtree()
+{
+	mRenderDirty = true;
+	mSubtreeRenderDirty = true;
+}
+
+void UIElement::WriteQuadsClipped(UIRenderList &list)
+{
+	if (list.IsClippedOut(layoutRect))
+	{
+		++layoutStats.clipped;
+		list.HideQuads(mFirstQuad, GetQuadCount());
+		return;
+	}
+
+	++layoutStats.rendered;
+	WriteQuads(list, mFirstQuad);
+}
+
+void Panel::AppendQuads(UIRenderList &list)
+{
+	UIElement::AppendQuads(list);
+
+	if (mClipToBounds)
+	{
+		mClipIndex = list.AllocateClip();
+		list.SetClipRect(mClipIndex,
+						 Intersect(layoutRect, list.GetClipRect()));
+		list.PushClip(mClipIndex);
+	}
+
+	for (const auto &child : mChildren)
+	{
+		child->AppendQuads(list);
+	}
+
+	if (mClipToBounds)
+		list.PopClip();
+}
+
+void Panel::RefreshQuads(UIRenderList &list)
+{
+	UIElement::RefreshQuads(list);
+
+	if (mClipToBounds)
+	{
+		// Children were culled against the old clip, all of them need
+		// another look
+		const Rect clip = Intersect(layoutRect, list.GetClipRect());
+		if (clip != list.clipRects[mClipIndex])
+		{
+			list.SetClipRect(mClipIndex, clip);
+			for (const auto &child : mChildren)
+			{
+				child->InvalidateRenderSubtree();
+			}
+		}
+
+		list.PushClip(mClipIndex);
+	}
+
+	for (const auto &child : mChildren)
+	{
+		if (child->mSubtreeRenderDirty)
+			child->RefreshQuads(list);
+	}
+
+	if (mClipToBounds)
+		list.PopClip();
+}
+
+void Panel::InvalidateRenderSubtree()
+{
+	UIElement::InvalidateRenderSubtree();
+
+	for (const auto &child : mChildren)
+	{
+		child->InvalidateRenderSubtree();
+	}
+}
+
+void Panel::SetClipToBounds(bool clip)
+{
+	if (mClipToBounds == clip)
+		return;
+
+	// Clip rects are allocated when the list is built
+	mClipToBounds = clip;
+	InvalidateRenderStructure();
+}
+
+void Panel::AddChildElement(std::unique_ptr<UIElement> child)
+{
+	child->parent = this;
+	child->indexInParent = mChildren.size();
+	mChildren.push_back(std::move(child));
+
+	InvalidateMeasure();
+	InvalidateRenderStructure();
+}
+
+void Panel::SetBackground(glm::vec4 background)
+{
+	mBackground = background;
+	InvalidateRender();
+}
+
+void Image::SetTexture(Texture texture)
+{
+	mTexture = texture;
+	InvalidateRender();
+}
+
+void VirtualizingStackPanel::SetItemSource(size_t itemCount,
+										   CreateContainerFn create,
+										   PrepareContainerFn prepare)
+{
+	mItemCount = itemCount;
+	mCreateContainer = std::move(create);
+	mPrepareContainer = std::move(prepare);
+
+	mChildren.clear();
+	mContainerItems.clear();
+
+	InvalidateMeasure();
+	InvalidateRenderStructure();
+}
+
+void VirtualizingStackPanel::SetItemCount(size_t itemCount)
+{
+	mItemCount = itemCount;
+	mContainerItems.assign(mChildren.size(), kNoItem);
+	InvalidateMeasure();
+}
+
+void VirtualizingStackPanel::SetItemExtent(float extent)
+{
+	mItemExtent = extent;
+	InvalidateMeasure();
+}
+
+void VirtualizingStackPanel::SetOrientation(Orientation orientation)
+{
+	if (mOrientation == orientation)
+		return;
+
+	mOrientation = orientation;
+	InvalidateMeasure();
+}
+
+void VirtualizingStackPanel::SetScrollOffset(double offset)
+{
+	if (mScrollOffset == offset)
+		return;
+
+	// Which items are realized is decided in measure
+	mScrollOffset = offset;
+	InvalidateMeasure();
+}
+
+Size VirtualizingStackPanel::MeasureOverride(Size available)
+{
+	const bool vertical = mOrientation == Orientation::Vertical;
+	const float viewport = vertical ? available.height : available.width;
+	const double content = GetContentExtent();
+
+	// The viewport size is only known now
+	mScrollOffset = std::clamp(mScrollOffset, 0.0,
+							   std::max(0.0, content - viewport));
+
+	// Partially visible items at both ends
+	size_t needed = 0;
+	if (mItemExtent > 0.f)
+	{
+		const double visible =
+			std::min(double(viewport) / mItemExtent, double(mItemCount));
+		needed = std::min(static_cast<size_t>(std::ceil(visible)) + 1,
+						  mItemCount);
+	}
+
+	// The item to container mapping depends on the container count
+	if (needed > mChildren.size() && mCreateContainer)
+	{
+		while (mChildren.size() < needed)
+			AddChildElement(mCreateContainer());
+
+		mContainerItems.assign(mChildren.size(), kNoItem);
+	}
+
+	const size_t containerCount = mChildren.size();
+	needed = std::min(needed, containerCount);
+
+	mFirstItem = 0;
+	if (mItemExtent > 0.f)
+	{
+		mFirstItem = std::min(static_cast<size_t>(mScrollOffset / mItemExtent),
+							  mItemCount - std::min(needed, mItemCount));
+	}
+	mLastItem = mFirstItem + needed;
+
+	const Size itemAvailable = vertical ? Size{available.width, mItemExtent}
+										: Size{mItemExtent, available.height};
+
+	float crossExtent = 0.f;
+	for (size_t c = 0; c < containerCount; ++c)
+	{
+		// The one item in [first, last) this container can show
+		const size_t item =
+			mFirstItem +
+			(c + containerCount - mFirstItem % containerCount) %
+				containerCount;
+
+		auto &container = static_cast<FrameworkElement &>(*mChildren[c]);
+
+		if (item >= mLastItem)
+		{
+			mContainerItems[c] = kNoItem;
+		}
+		else if (mContainerItems[c] != item)
+		{
+			mContainerItems[c] = item;
+			if (mPrepareContainer)
+				mPrepareContainer(container, item);
+		}
+
+		// Hidden containers are measured too, nothing is left dirty
+		container.Measure(itemAvailable);
+
+		if (mContainerItems[c] != kNoItem)
+		{
+			crossExtent =
+				std::max(crossExtent, vertical ? container.desiredSize.width
+											   : container.desiredSize.height);
+		}
+	}
+
+	const float extent =
+		static_cast<float>(std::min(content, double(viewport)));
+	return vertical ? Size{crossExtent, extent} : Size{extent, crossExtent};
+}
+
+void VirtualizingStackPanel::ArrangeOverride(Rect rect)
+{
+	const bool vertical = mOrientation == Orientation::Vertical;
+
+	for (size_t c = 0; c < mChildren.size(); ++c)
+	{
+		const size_t item = mContainerItems[c];
+		if (item == kNoItem)
+		{
+			mChildren[c]->Arrange({rect.x, rect.y, 0.f, 0.f});
+			continue;
+		}
+
+		const float offset = static_cast<float>(
+			static_cast<double>(item) * mItemExtent - mScrollOffset);
+
+		const Rect r = vertical ? Rect{rect.x, rect.y + offset, rect.width,
+									   mItemExtent}
+								: Rect{rect.x + offset, rect.y, mItemExtent,
+									   rect.height};
+		mChildren[c]->Arrange(r);
+	}
+}
+
+uint32_t UIRenderList::Allocate(uint32_t count)
+{
+	const uint32_t first = Size();
+
+	positions.resize(first + count);
+	sizes.resize(first + count);
+	colors.resize(first + count);
+	textures.resize(first + count);
+	clips.resize(first + count);
+
+	mResized = true;
+	return first;
+}
+
+void UIRenderList::Clear()
+{
+	positions.clear();
+	sizes.clear();
+	colors.clear();
+	textures.clear();
+	clips.clear();
+
+	constexpr float kHuge = 1e30f;
+	clipRects.assign(1, Rect{-kHuge, -kHuge, 2.f * kHuge, 2.f * kHuge});
+	mClipStack.assign(1, 0);
+	mClipRectsChanged = true;
+
+	mResized = true;
+	mDirtyBegin = UINT32_MAX;
+	mDirtyEnd = 0;
+}
+
+void UIRenderList::SetQuad(uint32_t index, glm::vec2 position, glm::vec2 size,
+						   glm::vec4 color, Texture texture)
+{
+	positions[index] = position;
+	sizes[index] = size;
+	colors[index] = color;
+	textures[index] = texture;
+	clips[index] = mClipStack.back();
+
+	mDirtyBegin = std::min(mDirtyBegin, index);
+	mDirtyEnd = std::max(mDirtyEnd, index + 1);
+}
+
+void UIRenderList::HideQuads(uint32_t first, uint32_t count)
+{
+	if (count == 0)
+		return;
+
+	for (uint32_t i = first; i < first + count; ++i)
+	{
+		sizes[i] = glm::vec2(0.f);
+		clips[i] = mClipStack.back(); // keeps batches together
+	}
+
+	mDirtyBegin = std::min(mDirtyBegin, first);
+	mDirtyEnd = std::max(mDirtyEnd, first + count);
+}
+
+uint32_t UIRenderList::AllocateClip()
+{
+	clipRects.push_back({});
+	mClipRectsChanged = true;
+	return static_cast<uint32_t>(clipRects.size() - 1);
+}
+
+void UIRenderList::SetClipRect(uint32_t clip, Rect rect)
+{
+	clipRects[clip] = rect;
+	mClipRectsChanged = true;
+}
+
+bool UIRenderList::IsClippedOut(Rect rect) const
+{
+	const Rect clip = GetClipRect();
+	return rect.width <= 0.f || rect.height <= 0.f ||
+		   rect.x >= clip.x + clip.width || rect.x + rect.width <= clip.x ||
+		   rect.y >= clip.y + clip.height || rect.y + rect.height <= clip.y;
+}
+
+void UIRenderList::Draw(Renderer &renderer)
+{
+	if (mQuads.id == 0)
+		mQuads = renderer.createUIQuadList();
+
+	if (mResized)
+	{
+		renderer.resizeUIQuadList(mQuads, Size());
+		mResized = false;
+	}
+
+	if (mClipRectsChanged)
+	{
+		mClipScratch.clear();
+		for (const Rect &rect : clipRects)
+			mClipScratch.emplace_back(rect.x, rect.y, rect.width, rect.height);
+
+		renderer.setUIClipRects(mQuads, mClipScratch.data(),
+								static_cast<uint32_t>(mClipScratch.size()));
+		mClipRectsChanged = false;
+	}
+
+	if (mDirtyBegin < mDirtyEnd)
+	{
+		renderer.writeUIQuads(mQuads, mDirtyBegin, mDirtyEnd - mDirtyBegin,
+							  &positions[mDirtyBegin], &sizes[mDirtyBegin],
+							  &colors[mDirtyBegin], &textures[mDirtyBegin],
+							  &clips[mDirtyBegin]);
+		mDirtyBegin = UINT32_MAX;
+		mDirtyEnd = 0;
+	}
+
+	renderer.drawUIQuadList(mQuads);
+}
+
+void UIRenderList::Destroy(Renderer &renderer)
+{
+	renderer.deleteUIQuadList(mQuads);
+	mQuads = {};
+}
+
+void FrameworkElement::SetWidth(float width)
+{
+	mWidth = width;
+	InvalidateMeasure();
+}
+
+void FrameworkElement::SetHeight(float height)
+{
+	mHeight = height;
+	InvalidateMeasure();
+}
+
+void FrameworkElement::SetMargin(Thickness margin)
+{
+	mMargin = margin;
+	InvalidateMeasure();
+}
+
+void FrameworkElement::SetHorizontalAlignment(HorizontalAlignment alignment)
+{
+	if (mHorizontalAlignment == alignment)
+		return;
+
+	mHorizontalAlignment = alignment;
+	InvalidateArrange();
+}
+
+void FrameworkElement::SetVerticalAlignment(VerticalAlignment alignment)
+{
+	if (mVerticalAlignment == alignment)
+		return;
+
+	mVerticalAlignment = alignment;
+	InvalidateArrange();
+}
+
+void StackPanel::SetSpacing(float spacing)
+{
+	mSpacing = spacing;
+	InvalidateMeasure();
+}
+
+void StackPanel::SetOrientation(Orientation orientation)
+{
+	if (mOrientation == orientation)
+		return;
+
+	mOrientation = orientation;
+	InvalidateMeasure();
+}
+
+void Image::SetSourceSize(Size sourceSize)
+{
+	mSourceSize = sourceSize;
+	InvalidateMeasure();
+}
+
+void FrameworkElement::MeasureCore(Size availableSize)
 {
 	// Deflate available space by margin
-	Size innerAvailable = Deflate(availableSize, margin);
+	Size innerAvailable = Deflate(availableSize, mMargin);
 
 	// Ask derived class how big it wants to be
 	Size desired = MeasureOverride(innerAvailable);
 
 	// Apply Width / Height overrides
-	if (!std::isnan(width))
+	if (!std::isnan(mWidth))
 	{
-		desired.width = width;
+		desired.width = mWidth;
 	}
-	if (!std::isnan(height))
+	if (!std::isnan(mHeight))
 	{
-		desired.height = height;
+		desired.height = mHeight;
 	}
 
 	// Desired size with margins
-	desiredSize = Inflate(desired, margin);
+	desiredSize = Inflate(desired, mMargin);
 }
 
-void FrameworkElement::Arrange(Rect finalRect)
+void FrameworkElement::ArrangeCore(Rect finalRect)
 {
-	Rect inner = Deflate(finalRect, margin);
+	Rect inner = Deflate(finalRect, mMargin);
 
 	float arrangedWidth = inner.width;
 	float arrangedHeight = inner.height;
 
 	// Alignment handling
-	if (!std::isnan(width))
+	if (!std::isnan(mWidth))
 	{
-		arrangedWidth = width;
+		arrangedWidth = mWidth;
 	}
-	else if (horizontalAlignment != HorizontalAlignment::Stretch)
+	else if (mHorizontalAlignment != HorizontalAlignment::Stretch)
 	{
-		arrangedWidth = desiredSize.width - margin.left - margin.right;
+		arrangedWidth = desiredSize.width - mMargin.left - mMargin.right;
 	}
 
-	if (!std::isnan(height))
+	if (!std::isnan(mHeight))
 	{
-		arrangedHeight = height;
+		arrangedHeight = mHeight;
 	}
-	else if (verticalAlignment != VerticalAlignment::Stretch)
+	else if (mVerticalAlignment != VerticalAlignment::Stretch)
 	{
-		arrangedHeight = desiredSize.height - margin.top - margin.bottom;
+		arrangedHeight = desiredSize.height - mMargin.top - mMargin.bottom;
 	}
 
 	arrangedWidth = std::min(arrangedWidth, inner.width);
@@ -406,20 +1039,20 @@ void FrameworkElement::Arrange(Rect finalRect)
 	float freeX = inner.width - arrangedWidth;
 	float freeY = inner.height - arrangedHeight;
 
-	if (horizontalAlignment == HorizontalAlignment::Center)
+	if (mHorizontalAlignment == HorizontalAlignment::Center)
 	{
 		x += freeX * 0.5f;
 	}
-	else if (horizontalAlignment == HorizontalAlignment::Right)
+	else if (mHorizontalAlignment == HorizontalAlignment::Right)
 	{
 		x += freeX;
 	}
 
-	if (verticalAlignment == VerticalAlignment::Center)
+	if (mVerticalAlignment == VerticalAlignment::Center)
 	{
 		y += freeY * 0.5f;
 	}
-	else if (verticalAlignment == VerticalAlignment::Bottom)
+	else if (mVerticalAlignment == VerticalAlignment::Bottom)
 	{
 		y += freeY;
 	}
@@ -436,36 +1069,59 @@ void TestUI::Init()
 
 	auto loadTex = [this, renderer](const char *path)
 	{
-		Texture tex = renderer->loadTexture(path);
+		Texture tex = renderer->loadAtlasTexture(path);
 		mUITextures.push_back(tex);
 		return tex;
 	};
 
 	mRoot = std::make_unique<Panel>();
 
+	// Opaque, the root doubles as the viewport background
+	mRoot->SetBackground({0.75f, 0.75f, 0.75f, 1.f});
+
 #if WITH_EDITOR
 	Engine::instance->editor->registerTool<UIInspector>(mRoot.get());
 #endif
 
 	auto *canvas = mRoot->AddChild<Canvas>();
-	canvas->width = 400.f;
-	canvas->height = 400.f;
+	canvas->SetWidth(400.f);
+	canvas->SetHeight(400.f);
 
 	auto *img = canvas->AddChild<Image>();
-	img->sourceSize = {100, 100};
+	img->SetSourceSize({100, 100});
 	canvas->SetLeft(img, 10.f);
 	canvas->SetTop(img, 10.f);
 
 	auto *stackPanel = mRoot->AddChild<StackPanel>();
-	stackPanel->horizontalAlignment = HorizontalAlignment::Center;
-	stackPanel->verticalAlignment = VerticalAlignment::Center;
+	stackPanel->SetHorizontalAlignment(HorizontalAlignment::Center);
+	stackPanel->SetVerticalAlignment(VerticalAlignment::Center);
 
 	for (int i = 0; i < 4; ++i)
 	{
 		auto *img = stackPanel->AddChild<Image>();
-		img->sourceSize = {100, 100};
-		img->margin = {10.f, 10.f, 10.f, 10.f};
+		img->SetSourceSize({100, 100});
+		img->SetMargin({10.f, 10.f, 10.f, 10.f});
 	}
+
+	// A million rows, only the ones on screen have an element
+	auto *list = mRoot->AddChild<VirtualizingStackPanel>();
+	list->SetWidth(200.f);
+	list->SetHorizontalAlignment(HorizontalAlignment::Right);
+	list->SetItemExtent(20.f);
+	list->SetItemSource(
+		1000000,
+		[]
+		{
+			auto row = std::make_unique<Panel>();
+			row->SetMargin({1.f, 0.f, 0.f, 0.f});
+			return row;
+		},
+		[](FrameworkElement &container, size_t index)
+		{
+			const float shade = index % 2 ? 0.3f : 0.4f;
+			static_cast<Panel &>(container).SetBackground(
+				{shade, shade, shade, 1.f});
+		});
 }
 
 void TestUI::Shutdown()
@@ -475,22 +1131,28 @@ void TestUI::Shutdown()
 	{
 		renderer->deleteTexture(tex);
 	}
+
+	mRenderList.Destroy(*renderer);
 }
 
 void TestUI::Render()
 {
-	// Perform layout
-	mRoot->Measure({800, 600});
-	mRoot->Arrange({50, 50, 800, 600});
+	PROFILE_SCOPE("TestUI::Render");
 
-	// Draw a viewport background
-	auto *renderer = Engine::instance->renderer.get();
+	// Perform layout, only dirty subtrees do any work
+	{
+		PROFILE_SCOPE("TestUI::Layout");
+		UIElement::layoutStats = {};
+		mRoot->Measure({800, 600});
+		mRoot->Arrange({50, 50, 800, 600});
+	}
 
-	renderer->drawUIQuad(
-		glm::vec2(mRoot->layoutRect.x, mRoot->layoutRect.y),
-		glm::vec2(mRoot->layoutRect.width, mRoot->layoutRect.height),
-		glm::vec4(0.5f, 0.5f, 0.5f, 1.f));
+	// Only elements whose layout or visuals changed rewrite their quads,
+	// an unchanged UI uploads nothing
+	{
+		PROFILE_SCOPE("TestUI::UpdateRenderList");
+		mRoot->UpdateRenderList(mRenderList);
+	}
 
-	// Render the tree
-	mRoot->Render(*renderer);
+	mRenderList.Draw(*Engine::instance->renderer);
 }
@@ -1,10 +1,11 @@
 #pragma once
 
+#include <cassert>
 #include <cmath>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include "../EngineDefs.h"
@@ -32,6 +33,31 @@ struct Thickness
 	float top = 0.f;
 };
 
+inline bool operator==(Size a, Size b)
+{
+	return a.width == b.width && a.height == b.height;
+}
+
+inline bool operator!=(Size a, Size b) { return !(a == b); }
+
+inline bool operator==(Rect a, Rect b)
+{
+	return a.x == b.x && a.y == b.y && a.width == b.width &&
+		   a.height == b.height;
+}
+
+inline bool operator!=(Rect a, Rect b) { return !(a == b); }
+
+// Overlap of two rects, empty (zero sized) if they don't touch
+inline Rect Intersect(Rect a, Rect b)
+{
+	const float x0 = std::max(a.x, b.x);
+	const float y0 = std::max(a.y, b.y);
+	const float x1 = std::min(a.x + a.width, b.x + b.width);
+	const float y1 = std::min(a.y + a.height, b.y + b.height);
+	return {x0, y0, std::max(0.f, x1 - x0), std::max(0.f, y1 - y0)};
+}
+
 inline Size Deflate(Size size, Thickness thick)
 {
 	return {std::max(0.f, size.width - thick.left - thick.right),
@@ -58,22 +84,152 @@ inline Rect Inflate(Rect rect, Thickness thick)
 			std::max(0.f, rect.height + thick.top + thick.bottom)};
 }
 
+// Measure and Arrange calls that did work, and elements that rewrote
+// their quads or hid them for being clipped out. Reset by whoever runs
+// layout.
+struct LayoutStats
+{
+	uint32_t measured = 0;
+	uint32_t arranged = 0;
+	uint32_t rendered = 0;
+	uint32_t clipped = 0;
+};
+
+// Quads of an element tree flattened in draw order, kept across frames.
+// Each element owns a contiguous range, followed by its children's.
+class UIRenderList
+{
+  public:
+	std::vector<glm::vec2> positions;
+	std::vector<glm::vec2> sizes;
+	std::vector<glm::vec4> colors;
+	std::vector<Texture> textures;
+	std::vector<uint32_t> clips; // into clipRects
+
+	// Clip rect of each clipping panel, already intersected with its
+	// ancestors'. Entry 0 is the unclipped screen.
+	std::vector<Rect> clipRects;
+
+	UIRenderList() { Clear(); }
+
+	uint32_t Size() const { return static_cast<uint32_t>(positions.size()); }
+
+	// Appends count quads, returns the index of the first
+	uint32_t Allocate(uint32_t count);
+	void Clear();
+
+	// Quads are clipped to the rect on top of the clip stack when set
+	void SetQuad(uint32_t index, glm::vec2 position, glm::vec2 size,
+				 glm::vec4 color, Texture texture = {});
+
+	// Makes quads invisible, for elements entirely outside the clip
+	void HideQuads(uint32_t first, uint32_t count);
+
+	uint32_t AllocateClip();
+	void SetClipRect(uint32_t clip, Rect rect);
+
+	// Clip stack, walked while elements write their quads
+	void PushClip(uint32_t clip) { mClipStack.push_back(clip); }
+	void PopClip() { mClipStack.pop_back(); }
+	Rect GetClipRect() const { return clipRects[mClipStack.back()]; }
+
+	// True if nothing of rect is inside the current clip
+	bool IsClippedOut(Rect rect) const;
+
+	// Sends the quads set since the last draw to the renderer's copy and
+	// draws it, call between begin2D and end2D
+	void Draw(Renderer &renderer);
+	void Destroy(Renderer &renderer);
+
+  private:
+	UIQuadList mQuads;
+	bool mResized = false;
+	bool mClipRectsChanged = false;
+
+	std::vector<uint32_t> mClipStack;
+	std::vector<glm::vec4> mClipScratch; // clipRects for the renderer
+
+	uint32_t mDirtyBegin = UINT32_MAX;
+	uint32_t mDirtyEnd = 0;
+};
+
 class UIElement
 {
   public:
-	Size desiredSize; // result of Measure. Content size + margin
-	Rect layoutRect;  // result of Arrange
+	Size desiredSize = {}; // result of Measure. Content size + margin
+	Rect layoutRect = {};  // result of Arrange
+
+	class Panel *parent = nullptr;
+	size_t indexInParent = 0; // into the parent's children
+
+	static LayoutStats layoutStats;
 
 	virtual ~UIElement() {}
 
-	virtual void Measure(Size availableSize) = 0;
-	virtual void Arrange(Rect finalRect) { layoutRect = finalRect; }
+	// Both return straight away if nothing was invalidated and the input
+	// is the same as last time, reusing desiredSize / layoutRect
+	void Measure(Size availableSize);
+	void Arrange(Rect finalRect);
 
-	virtual void Render(Renderer &renderer) = 0;
+	// Marks this element and its ancestors for layout. Anything that
+	// changes desiredSize invalidates measure, anything that only moves
+	// the element within its slot invalidates arrange.
+	void InvalidateMeasure();
+	void InvalidateArrange();
 
-#if WITH_EDITOR
-	class Panel *owningPanel = nullptr;
-#endif
+	bool IsMeasureValid() const { return !mMeasureDirty; }
+	bool IsArrangeValid() const { return !mArrangeDirty; }
+
+	// Marks the element's quads for rewriting, for visual changes that
+	// don't affect layout. Arranging to a different rect does this too.
+	void InvalidateRender();
+
+	// Brings list up to date with the tree, called on the root. Rebuilds
+	// it the first time and after children are added, otherwise only the
+	// invalidated elements rewrite their quads.
+	void UpdateRenderList(UIRenderList &list);
+
+  protected:
+	virtual void MeasureCore(Size availableSize) = 0;
+	virtual void ArrangeCore(Rect finalRect) { layoutRect = finalRect; }
+
+	// Quads the element draws itself, fixed for its lifetime
+	virtual uint32_t GetQuadCount() const { return 0; }
+	virtual void WriteQuads(UIRenderList &list, uint32_t first) {}
+
+	// Appends the subtree to the list, or rewrites its invalidated
+	// elements. Panels extend these to visit their children.
+	virtual void AppendQuads(UIRenderList &list);
+	virtual void RefreshQuads(UIRenderList &list);
+
+	// Marks every element of the subtree for rewriting, for when the clip
+	// they were culled against changed
+	virtual void InvalidateRenderSubtree();
+
+	// Children were added or removed, the list is rebuilt
+	void InvalidateRenderStructure();
+
+  private:
+	friend class Panel;
+
+	// Dirty elements always have dirty ancestors, so invalidation can stop
+	// at the first one already marked
+	bool mMeasureDirty = true;
+	bool mArrangeDirty = true;
+
+	Size mPreviousAvailableSize = {};
+	Rect mPreviousFinalRect = {};
+
+	// Same for rendering, mSubtreeRenderDirty is set on the element and
+	// its ancestors
+	bool mRenderDirty = true;
+	bool mSubtreeRenderDirty = true;
+	bool mRenderStructureDirty = true;
+
+	uint32_t mFirstQuad = 0;
+
+	// Writes the element's quads, or hides them if it's clipped out
+	void WriteQuadsClipped(UIRenderList &list);
 };
 
 enum class HorizontalAlignment
@@ -95,34 +251,50 @@ enum class VerticalAlignment
 class FrameworkElement : public UIElement
 {
   public:
-	float width = std::numeric_limits<float>::quiet_NaN();	// NaN = Auto
-	float height = std::numeric_limits<float>::quiet_NaN(); // NaN = Auto
-
-	Thickness margin;
-
-	HorizontalAlignment horizontalAlignment = HorizontalAlignment::Stretch;
-	VerticalAlignment verticalAlignment = VerticalAlignment::Stretch;
-
 	virtual ~FrameworkElement() {}
 
 #if WITH_EDITOR
 	virtual const char *getClassName() = 0;
 #endif
 
-	virtual void Measure(Size availableSize) override;
-	virtual void Arrange(Rect finalRect) override;
+	// NaN = Auto
+	float GetWidth() const { return mWidth; }
+	float GetHeight() const { return mHeight; }
+	void SetWidth(float width);
+	void SetHeight(float height);
 
-	virtual void Render(Renderer &renderer) override
+	const Thickness &GetMargin() const { return mMargin; }
+	void SetMargin(Thickness margin);
+
+	HorizontalAlignment GetHorizontalAlignment() const
 	{
-		// Framework elements render themselves
+		return mHorizontalAlignment;
 	}
+	VerticalAlignment GetVerticalAlignment() const
+	{
+		return mVerticalAlignment;
+	}
+	void SetHorizontalAlignment(HorizontalAlignment alignment);
+	void SetVerticalAlignment(VerticalAlignment alignment);
 
   protected:
+	void MeasureCore(Size availableSize) override;
+	void ArrangeCore(Rect finalRect) override;
+
 	virtual Size MeasureOverride(Size availableSize) = 0;
 	virtual void ArrangeOverride(Rect finalRect)
 	{
-		UIElement::Arrange(finalRect);
+		UIElement::ArrangeCore(finalRect);
 	}
+
+  private:
+	float mWidth = std::numeric_limits<float>::quiet_NaN();
+	float mHeight = std::numeric_limits<float>::quiet_NaN();
+
+	Thickness mMargin;
+
+	HorizontalAlignment mHorizontalAlignment = HorizontalAlignment::Stretch;
+	VerticalAlignment mVerticalAlignment = VerticalAlignment::Stretch;
 };
 
 // Panels arrange children
@@ -137,30 +309,36 @@ class Panel : public FrameworkElement
 	{
 		static_assert(std::is_base_of_v<UIElement, T>);
 		auto child = std::make_unique<T>(std::forward<Args>(args)...);
-#if WITH_EDITOR
-		child->owningPanel = this;
-#endif
 		T *ptr = child.get();
-		mChildren.push_back(std::move(child));
+		AddChildElement(std::move(child));
 		return ptr;
 	}
 
-	void Render(Renderer &renderer) override
-	{
-		renderer.drawUIQuad(glm::vec2(layoutRect.x, layoutRect.y),
-							glm::vec2(layoutRect.width, layoutRect.height),
-							background);
+	glm::vec4 GetBackground() const { return mBackground; }
+	void SetBackground(glm::vec4 background);
 
-		// Panels render children
-		for (const auto &child : mChildren)
-		{
-			child->Render(renderer);
-		}
+	// Clips children to the panel's rect, children entirely outside it
+	// aren't drawn
+	bool GetClipToBounds() const { return mClipToBounds; }
+	void SetClipToBounds(bool clip);
+
+  protected:
+	uint32_t GetQuadCount() const override { return 1; }
+
+	void WriteQuads(UIRenderList &list, uint32_t first) override
+	{
+		list.SetQuad(first, glm::vec2(layoutRect.x, layoutRect.y),
+					 glm::vec2(layoutRect.width, layoutRect.height),
+					 mBackground);
 	}
 
-	glm::vec4 background = {1.f, 1.f, 1.f, 0.5f};
+	// Panels draw their children over their background
+	void AppendQuads(UIRenderList &list) override;
+	void RefreshQuads(UIRenderList &list) override;
+	void InvalidateRenderSubtree() override;
+
+	void AddChildElement(std::unique_ptr<UIElement> child);
 
-  protected:
 	Size MeasureOverride(Size available) override
 	{
 		Size maxSize{0, 0};
@@ -185,6 +363,11 @@ class Panel : public FrameworkElement
 	std::vector<std::unique_ptr<UIElement>> mChildren;
 
   private:
+	glm::vec4 mBackground = {1.f, 1.f, 1.f, 0.5f};
+
+	bool mClipToBounds = false;
+	uint32_t mClipIndex = 0; // into the render list's clipRects
+
 #if WITH_EDITOR
 	friend class UIInspector;
 #endif
@@ -197,31 +380,61 @@ class Canvas : public Panel
 	virtual const char *getClassName() override { return "Canvas"; };
 #endif
 
+	// Attached properties of a child, NaN = unset
+	float GetLeft(const UIElement *element) const
+	{
+		return GetSlot(element).left;
+	}
+	float GetTop(const UIElement *element) const
+	{
+		return GetSlot(element).top;
+	}
+	float GetRight(const UIElement *element) const
+	{
+		return GetSlot(element).right;
+	}
+	float GetBottom(const UIElement *element) const
+	{
+		return GetSlot(element).bottom;
+	}
+
 	void SetLeft(UIElement *element, float left)
 	{
-		mSlots[element].left = left;
+		GetSlot(element).left = left;
+		InvalidateMeasure();
 	}
 
-	void SetTop(UIElement *element, float top) { mSlots[element].top = top; }
+	void SetTop(UIElement *element, float top)
+	{
+		GetSlot(element).top = top;
+		InvalidateMeasure();
+	}
 
 	void SetRight(UIElement *element, float right)
 	{
-		mSlots[element].right = right;
+		GetSlot(element).right = right;
+		InvalidateMeasure();
 	}
 
 	void SetBottom(UIElement *element, float bottom)
 	{
-		mSlots[element].bottom = bottom;
+		GetSlot(element).bottom = bottom;
+		InvalidateMeasure();
 	}
 
   protected:
 	Size MeasureOverride(Size available) override
 	{
+		// Children added since the last Set* call get default slots
+		mSlots.resize(mChildren.size());
+
 		Size maxSize{0, 0};
-		for (auto &child : mChildren)
+		for (size_t i = 0; i < mChildren.size(); ++i)
 		{
+			UIElement *child = mChildren[i].get();
+			const CanvasSlot &slot = mSlots[i];
+
 			child->Measure(available);
-			auto &slot = mSlots[child.get()];
 
 			float x =
 				!std::isnan(slot.left) ? slot.left
@@ -245,9 +458,11 @@ class Canvas : public Panel
 
 	void ArrangeOverride(Rect rect) override
 	{
-		for (auto &child : mChildren)
+		// Measure always runs first and sized mSlots
+		for (size_t i = 0; i < mChildren.size(); ++i)
 		{
-			auto &slot = mSlots[child.get()];
+			UIElement *child = mChildren[i].get();
+			const CanvasSlot &slot = mSlots[i];
 
 			float x = rect.x;
 			float y = rect.y;
@@ -285,11 +500,25 @@ class Canvas : public Panel
 		float bottom = std::numeric_limits<float>::quiet_NaN();
 	};
 
-	std::unordered_map<UIElement *, CanvasSlot> mSlots;
+	CanvasSlot &GetSlot(const UIElement *element)
+	{
+		assert(element->parent == this);
+		if (element->indexInParent >= mSlots.size())
+			mSlots.resize(mChildren.size());
+		return mSlots[element->indexInParent];
+	}
 
-#if WITH_EDITOR
-	friend class UIInspector;
-#endif
+	const CanvasSlot &GetSlot(const UIElement *element) const
+	{
+		assert(element->parent == this);
+		static const CanvasSlot unset;
+		return element->indexInParent < mSlots.size()
+				   ? mSlots[element->indexInParent]
+				   : unset;
+	}
+
+	// Parallel to mChildren, may be shorter until the next measure
+	std::vector<CanvasSlot> mSlots;
 };
 
 enum class Orientation
@@ -305,8 +534,11 @@ class StackPanel : public Panel
 	virtual const char *getClassName() override { return "StackPanel"; };
 #endif
 
-	float spacing = 0;
-	Orientation orientation = Orientation::Vertical;
+	float GetSpacing() const { return mSpacing; }
+	void SetSpacing(float spacing);
+
+	Orientation GetOrientation() const { return mOrientation; }
+	void SetOrientation(Orientation orientation);
 
   protected:
 	Size MeasureOverride(Size available) override
@@ -317,7 +549,7 @@ class StackPanel : public Panel
 		{
 			child->Measure(available);
 
-			if (orientation == Orientation::Vertical)
+			if (mOrientation == Orientation::Vertical)
 			{
 				total.height += child->desiredSize.height;
 				total.width = std::max(total.width, child->desiredSize.width);
@@ -332,10 +564,10 @@ class StackPanel : public Panel
 
 		if (!mChildren.empty())
 		{
-			if (orientation == Orientation::Vertical)
-				total.height += spacing * (mChildren.size() - 1);
+			if (mOrientation == Orientation::Vertical)
+				total.height += mSpacing * (mChildren.size() - 1);
 			else // Horizontal
-				total.width += spacing * (mChildren.size() - 1);
+				total.width += mSpacing * (mChildren.size() - 1);
 		}
 
 		return total;
@@ -349,22 +581,106 @@ class StackPanel : public Panel
 		{
 			Rect r;
 
-			if (orientation == Orientation::Vertical)
+			if (mOrientation == Orientation::Vertical)
 			{
 				r = {rect.x, rect.y + offset, rect.width,
 					 child->desiredSize.height};
-				offset += r.height + spacing;
+				offset += r.height + mSpacing;
 			}
 			else // Horizontal
 			{
 				r = {rect.x + offset, rect.y, child->desiredSize.width,
 					 rect.height};
-				offset += r.width + spacing;
+				offset += r.width + mSpacing;
 			}
 
 			child->Arrange(r);
 		}
 	}
+
+  private:
+	float mSpacing = 0;
+	Orientation mOrientation = Orientation::Vertical;
+};
+
+// Stack of items generated on demand. Only items in the viewport get a
+// container and containers are recycled as the list scrolls, so the work
+// per frame depends on the viewport size rather than the item count.
+// Every item has the same extent along the orientation.
+class VirtualizingStackPanel : public Panel
+{
+  public:
+	// Items scroll past the edges, so the panel clips by default
+	VirtualizingStackPanel() { SetClipToBounds(true); }
+
+#if WITH_EDITOR
+	virtual const char *getClassName() override
+	{
+		return "VirtualizingStackPanel";
+	};
+#endif
+
+	// Makes an empty container, only called while the pool is too small
+	// for the viewport
+	using CreateContainerFn =
+		std::function<std::unique_ptr<FrameworkElement>()>;
+
+	// Fills a container with the item at index
+	using PrepareContainerFn =
+		std::function<void(FrameworkElement &container, size_t index)>;
+
+	// Replaces the items, containers made for an earlier source are
+	// dropped
+	void SetItemSource(size_t itemCount, CreateContainerFn create,
+					   PrepareContainerFn prepare);
+
+	// The items changed, visible containers are prepared again
+	void SetItemCount(size_t itemCount);
+	size_t GetItemCount() const { return mItemCount; }
+
+	float GetItemExtent() const { return mItemExtent; }
+	void SetItemExtent(float extent);
+
+	Orientation GetOrientation() const { return mOrientation; }
+	void SetOrientation(Orientation orientation);
+
+	// Distance scrolled from the first item, clamped to the content by the
+	// next measure. Double, a million items run past float precision.
+	double GetScrollOffset() const { return mScrollOffset; }
+	void SetScrollOffset(double offset);
+
+	// Length of all items together, for scroll bars
+	double GetContentExtent() const
+	{
+		return static_cast<double>(mItemCount) * mItemExtent;
+	}
+
+	// Items with a container after the last measure, [first, last)
+	size_t GetFirstRealizedItem() const { return mFirstItem; }
+	size_t GetLastRealizedItem() const { return mLastItem; }
+
+  protected:
+	Size MeasureOverride(Size available) override;
+	void ArrangeOverride(Rect rect) override;
+
+  private:
+	static constexpr size_t kNoItem = std::numeric_limits<size_t>::max();
+
+	CreateContainerFn mCreateContainer;
+	PrepareContainerFn mPrepareContainer;
+
+	size_t mItemCount = 0;
+	float mItemExtent = 20.f;
+	Orientation mOrientation = Orientation::Vertical;
+	double mScrollOffset = 0.0;
+
+	// Realized items, item i is shown by container i % mChildren.size() so
+	// scrolling by one item only prepares one container
+	size_t mFirstItem = 0;
+	size_t mLastItem = 0;
+
+	// Item each container shows or kNoItem, parallel to mChildren
+	std::vector<size_t> mContainerItems;
 };
 
 class Image : public FrameworkElement
@@ -374,24 +690,33 @@ class Image : public FrameworkElement
 	virtual const char *getClassName() override { return "Image"; };
 #endif
 
-	Size sourceSize;
-	Texture texture = {};
+	Size GetSourceSize() const { return mSourceSize; }
+	void SetSourceSize(Size sourceSize);
+
+	Texture GetTexture() const { return mTexture; }
+	void SetTexture(Texture texture);
+
+  protected:
+	uint32_t GetQuadCount() const override { return 1; }
 
-	void Render(Renderer &renderer) override
+	void WriteQuads(UIRenderList &list, uint32_t first) override
 	{
-		renderer.drawUIQuad(glm::vec2(layoutRect.x, layoutRect.y),
-							glm::vec2(layoutRect.width, layoutRect.height),
-							glm::vec4(0.0f, 1.0f, 1.0f, 1.0f), texture);
+		list.SetQuad(first, glm::vec2(layoutRect.x, layoutRect.y),
+					 glm::vec2(layoutRect.width, layoutRect.height),
+					 glm::vec4(0.0f, 1.0f, 1.0f, 1.0f), mTexture);
 	}
 
-  protected:
 	Size MeasureOverride(Size available) override
 	{
-		return {std::min(sourceSize.width, available.width),
-				std::min(sourceSize.height, available.height)};
+		return {std::min(mSourceSize.width, available.width),
+				std::min(mSourceSize.height, available.height)};
 	}
 
 	void ArrangeOverride(Rect rect) override { layoutRect = rect; }
+
+  private:
+	Size mSourceSize = {};
+	Texture mTexture = {};
 };
 
 class TestUI
@@ -404,4 +729,6 @@ class TestUI
   private:
 	std::unique_ptr<Panel> mRoot;
 	std::vector<Texture> mUITextures;
+
+	UIRenderList mRenderList;
 };
@@ -1,10 +1,30 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
 #include <gsl/span>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <vector>
 
 #include "Entity.h"
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "Renderer.h"
+#include "SpatialHashGrid.h"
+
+// Weak reference to an entity. Stays valid to hold after the entity is
+// destroyed, World::get then returns nullptr.
+template <typename T> struct EntityHandle
+{
+	uint32_t slot = 0;
+	uint32_t generation = 0; // 0 is never a live generation
+
+	explicit operator bool() const { return generation != 0; }
+};
 
 class World
 {
@@ -14,50 +34,526 @@ class World
 	virtual void init() {}
 	virtual void shutdown() noexcept {}
 
+	// Entity types with kParallelUpdate set are updated across these
+	// workers. Without one everything updates on the calling thread.
+	void setJobSystem(JobSystem *jobs) { mJobs = jobs; }
+
+	// Entities outside this renderer's frustum are skipped by render.
+	// Without one everything is drawn.
+	void setRenderer(Renderer *renderer) { mRenderer = renderer; }
+
 	template <typename T, typename... Args> T *createEntity(Args &&...args)
 	{
 		static_assert(std::is_base_of_v<Entity, T>);
-		auto e = std::make_unique<T>(std::forward<Args>(args)...);
-		/*e->mWorld = this;*/
-		T *ptr = e.get();
-		mEntities.push_back(std::move(e));
-		return ptr;
+		assert(!mInParallelUpdate && "use defer() from parallel updates");
+		T *e = getOrCreatePool<T>()->create(std::forward<Args>(args)...);
+		e->mWorld = this;
+		e->mTypeId = static_cast<uint32_t>(typeId<T>());
+
+		// Filed where it is now, position changes are picked up at the end
+		// of each update
+		mGrid.insert(e);
+		return e;
+	}
+
+	template <typename T> EntityHandle<T> handleOf(const T *entity) const
+	{
+		static_assert(std::is_base_of_v<Entity, T>);
+
+		const auto *pool = getPool<T>();
+		assert(pool);
+		return {entity->mSlot, pool->slot(entity->mSlot).generation};
 	}
 
+	// nullptr if the entity has been destroyed
+	template <typename T> T *get(EntityHandle<T> handle)
+	{
+		static_assert(std::is_base_of_v<Entity, T>);
+
+		auto *pool = getPool<T>();
+		if (!pool || !handle)
+			return nullptr;
+
+		return pool->get(handle);
+	}
+
+	// All entities of exactly type T, derived types live in their own pool
+	// and are not included.
 	template <typename T> gsl::span<T *> view()
 	{
 		static_assert(std::is_base_of_v<Entity, T>);
 
-		mViewScratch.clear();
+		auto *pool = getPool<T>();
+		if (!pool)
+			return {};
 
-		for (auto &e : mEntities)
-		{
-			if (auto *t = dynamic_cast<T *>(e.get()))
-				mViewScratch.push_back(t);
-		}
+		return {pool->entities.data(), pool->entities.size()};
+	}
 
-		return {reinterpret_cast<T **>(mViewScratch.data()),
-				mViewScratch.size()};
+	// Entities of exactly type T (all of them for T = Entity) within radius
+	// of center. The grid is brought up to date at the end of update, an
+	// entity moved since then may be missed.
+	template <typename T>
+	void queryRadius(glm::vec3 center, float radius, std::vector<T *> &out)
+	{
+		mGrid.queryRadius(center, radius,
+						  [&](Entity *e)
+						  {
+							  if (isType<T>(e))
+								  out.push_back(static_cast<T *>(e));
+						  });
+	}
+
+	// Entities of exactly type T inside the box, same caveat as queryRadius
+	template <typename T>
+	void queryAabb(glm::vec3 min, glm::vec3 max, std::vector<T *> &out)
+	{
+		mGrid.queryAabb(min, max,
+						[&](Entity *e)
+						{
+							if (isType<T>(e))
+								out.push_back(static_cast<T *>(e));
+						});
+	}
+
+	const SpatialHashGrid &grid() const { return mGrid; }
+
+	// Queues a command that touches shared world state (createEntity,
+	// anything outside the entity itself). Safe to call from parallel
+	// updates. Commands run after all entities have updated, ordered by
+	// the entity that issued them, so the result doesn't depend on thread
+	// timing. Commands from outside an entity update run at the end of the
+	// next update, after those.
+	void defer(std::function<void(World &)> command)
+	{
+		std::lock_guard<std::mutex> lock(mDeferredMutex);
+		mDeferred.push_back({deferOrder(), std::move(command)});
 	}
 
 	virtual void update(float dt)
 	{
-		for (auto &e : mEntities)
-			e->update(dt);
+		PROFILE_SCOPE("World::update");
 
-		mEntities.erase(std::remove_if(mEntities.begin(), mEntities.end(),
-									   [](const auto &e)
-									   { return e->isPendingDestroy(); }),
-						mEntities.end());
+		// Indexed loops, entities can create entities (and pools) while
+		// updating. Anything created this tick is first updated next tick.
+		const size_t poolCount = mPools.size();
+		for (size_t i = 0; i < poolCount; ++i)
+		{
+			if (mPools[i])
+				mPools[i]->update(*this, static_cast<uint32_t>(i), dt);
+		}
+
+		{
+			PROFILE_SCOPE("World::runDeferred");
+			runDeferred();
+		}
+		{
+			PROFILE_SCOPE("World::processPendingDestroy");
+			processPendingDestroy();
+		}
+		{
+			PROFILE_SCOPE("World::updateGrid");
+			for (auto &pool : mPools)
+			{
+				if (pool)
+					pool->updateGrid(mGrid);
+			}
+		}
 	}
 
+	// Culls every entity's bounding sphere against the frustum in one pass,
+	// then renders the visible ones
 	virtual void render()
 	{
-		for (auto &e : mEntities)
-			e->render();
+		PROFILE_SCOPE("World::render");
+
+		mCull.clear();
+		for (auto &pool : mPools)
+		{
+			if (pool)
+				pool->gatherBounds(mCull);
+		}
+
+		const size_t count = mCull.radius.size();
+		mCull.visible.resize(count);
+
+		if (mRenderer)
+		{
+			PROFILE_SCOPE("World::cull");
+
+			const size_t drawn = mRenderer->frustum().cullSpheres(
+				mCull.x.data(), mCull.y.data(), mCull.z.data(),
+				mCull.radius.data(), count, mCull.visible.data());
+			mRenderer->countCulling(static_cast<uint32_t>(drawn),
+									static_cast<uint32_t>(count - drawn));
+		}
+		else
+		{
+			std::fill(mCull.visible.begin(), mCull.visible.end(), 1);
+		}
+
+		const uint8_t *visible = mCull.visible.data();
+		for (auto &pool : mPools)
+		{
+			if (pool)
+				visible = pool->render(visible);
+		}
 	}
 
   private:
-	std::vector<std::unique_ptr<Entity>> mEntities;
-	std::vector<Entity *> mViewScratch; // scratch mem for allocation
+	// Bounding spheres of every entity in pool order, and whether each one
+	// passed culling
+	struct CullSpheres
+	{
+		std::vector<float> x, y, z, radius;
+		std::vector<uint8_t> visible;
+
+		void clear()
+		{
+			x.clear();
+			y.clear();
+			z.clear();
+			radius.clear();
+		}
+	};
+
+	struct EntityPoolBase
+	{
+		virtual ~EntityPoolBase() = default;
+
+		virtual void update(World &world, uint32_t poolIndex, float dt) = 0;
+		virtual void gatherBounds(CullSpheres &spheres) = 0;
+		virtual void updateGrid(SpatialHashGrid &grid) = 0;
+
+		// Renders entities whose visible flag is set, returns the flags of
+		// the next pool
+		virtual const uint8_t *render(const uint8_t *visible) = 0;
+		virtual void destroy(Entity *e) = 0;
+	};
+
+	// Slab allocator for one concrete entity type. Entities are constructed
+	// in place in fixed size chunks, freed slots are reused through a free
+	// list, and a generation per slot invalidates stale handles. The dense
+	// array lists live entities for iteration and views.
+	template <typename T> struct EntityPool : EntityPoolBase
+	{
+		static constexpr uint32_t kChunkSize = 1024;
+		static constexpr uint32_t kNone = ~0u;
+
+		struct Slot
+		{
+			alignas(T) unsigned char storage[sizeof(T)];
+			uint32_t generation = 1;
+			uint32_t nextFree = kNone;
+			uint32_t denseIndex = kNone; // kNone while free
+
+			T *object() { return std::launder(reinterpret_cast<T *>(storage)); }
+		};
+
+		~EntityPool() override
+		{
+			for (T *e : entities)
+				e->~T();
+		}
+
+		Slot &slot(uint32_t index)
+		{
+			return chunks[index / kChunkSize][index % kChunkSize];
+		}
+
+		const Slot &slot(uint32_t index) const
+		{
+			return chunks[index / kChunkSize][index % kChunkSize];
+		}
+
+		template <typename... Args> T *create(Args &&...args)
+		{
+			if (freeHead == kNone)
+				grow();
+
+			const uint32_t index = freeHead;
+			Slot &s = slot(index);
+
+			T *e = new (s.storage) T(std::forward<Args>(args)...);
+			e->mSlot = index;
+
+			freeHead = s.nextFree;
+			s.nextFree = kNone;
+			s.denseIndex = static_cast<uint32_t>(entities.size());
+			entities.push_back(e);
+
+			return e;
+		}
+
+		void release(T *e)
+		{
+			const uint32_t index = e->mSlot;
+			Slot &s = slot(index);
+
+			e->~T();
+
+			++s.generation;
+			s.denseIndex = kNone;
+			s.nextFree = freeHead;
+			freeHead = index;
+		}
+
+		T *get(EntityHandle<T> handle)
+		{
+			if (handle.slot >= chunks.size() * kChunkSize)
+				return nullptr;
+
+			Slot &s = slot(handle.slot);
+			if (s.generation != handle.generation || s.denseIndex == kNone)
+				return nullptr;
+
+			return s.object();
+		}
+
+		void update(World &world, uint32_t poolIndex, float dt) override
+		{
+			const uint64_t orderBase = uint64_t(poolIndex) << 32;
+			const size_t count = entities.size();
+
+			if constexpr (T::kParallelUpdate)
+			{
+				constexpr size_t kGrain = 256;
+				if (world.mJobs && count > kGrain)
+				{
+					world.mInParallelUpdate = true;
+					world.mJobs->parallelFor(
+						count, kGrain,
+						[this, orderBase, dt](size_t begin, size_t end)
+						{
+							PROFILE_SCOPE("World::updateChunk");
+							for (size_t i = begin; i < end; ++i)
+							{
+								deferOrder() = orderBase | i;
+								entities[i]->update(dt);
+							}
+							deferOrder() = kNoDeferOrder;
+						});
+					world.mInParallelUpdate = false;
+					return;
+				}
+			}
+
+			for (size_t i = 0; i < count; ++i)
+			{
+				deferOrder() = orderBase | i;
+				entities[i]->update(dt);
+			}
+			deferOrder() = kNoDeferOrder;
+		}
+
+		void gatherBounds(CullSpheres &spheres) override
+		{
+			for (T *e : entities)
+			{
+				// Called on T, so a derived class's boundingSphere is used
+				// without a virtual call
+				glm::vec3 center;
+				float radius;
+				e->boundingSphere(center, radius);
+
+				spheres.x.push_back(center.x);
+				spheres.y.push_back(center.y);
+				spheres.z.push_back(center.z);
+				spheres.radius.push_back(radius);
+			}
+		}
+
+		void updateGrid(SpatialHashGrid &grid) override
+		{
+			for (T *e : entities)
+				grid.update(e);
+		}
+
+		const uint8_t *render(const uint8_t *visible) override
+		{
+			for (T *e : entities)
+			{
+				if (*visible++)
+					e->render();
+			}
+
+			return visible;
+		}
+
+		// Swap-and-pop out of the dense array, then free the slot
+		void destroy(Entity *entity) override
+		{
+			T *e = static_cast<T *>(entity);
+			Slot &s = slot(e->mSlot);
+
+			T *last = entities.back();
+			entities[s.denseIndex] = last;
+			slot(last->mSlot).denseIndex = s.denseIndex;
+			entities.pop_back();
+
+			release(e);
+		}
+
+		std::vector<T *> entities; // dense, live entities only
+
+	  private:
+		void grow()
+		{
+			const uint32_t base =
+				static_cast<uint32_t>(chunks.size()) * kChunkSize;
+			chunks.push_back(std::make_unique<Slot[]>(kChunkSize));
+
+			// Thread the new slots onto the free list in order
+			for (uint32_t i = kChunkSize; i-- > 0;)
+			{
+				chunks.back()[i].nextFree = freeHead;
+				freeHead = base + i;
+			}
+		}
+
+		std::vector<std::unique_ptr<Slot[]>> chunks;
+		uint32_t freeHead = kNone;
+	};
+
+	static size_t nextTypeId()
+	{
+		static size_t nextId = 0;
+		return nextId++;
+	}
+
+	// Small sequential id per entity type, used to index mPools
+	template <typename T> static size_t typeId()
+	{
+		static const size_t id = nextTypeId();
+		return id;
+	}
+
+	template <typename T> bool isType(const Entity *e) const
+	{
+		if constexpr (std::is_same_v<T, Entity>)
+			return true;
+		else
+			return e->mTypeId == typeId<T>();
+	}
+
+	template <typename T> EntityPool<T> *getPool()
+	{
+		const size_t id = typeId<T>();
+		if (id >= mPools.size())
+			return nullptr;
+
+		return static_cast<EntityPool<T> *>(mPools[id].get());
+	}
+
+	template <typename T> const EntityPool<T> *getPool() const
+	{
+		return const_cast<World *>(this)->getPool<T>();
+	}
+
+	template <typename T> EntityPool<T> *getOrCreatePool()
+	{
+		const size_t id = typeId<T>();
+		if (id >= mPools.size())
+			mPools.resize(id + 1);
+
+		if (!mPools[id])
+			mPools[id] = std::make_unique<EntityPool<T>>();
+
+		return static_cast<EntityPool<T> *>(mPools[id].get());
+	}
+
+	static constexpr uint64_t kNoDeferOrder = ~uint64_t(0);
+
+	// Pool index and dense index of the entity updating on this thread
+	static uint64_t &deferOrder()
+	{
+		static thread_local uint64_t order = kNoDeferOrder;
+		return order;
+	}
+
+	void runDeferred()
+	{
+		if (mDeferred.empty())
+			return;
+
+		// Stable, commands from the same entity keep their order
+		std::stable_sort(mDeferred.begin(), mDeferred.end(),
+						 [](const DeferredCommand &a, const DeferredCommand &b)
+						 { return a.order < b.order; });
+
+		// Commands may defer more commands, those run next tick
+		std::vector<DeferredCommand> commands;
+		commands.swap(mDeferred);
+
+		for (auto &command : commands)
+			command.fn(*this);
+	}
+
+	// Destroys everything queued by Entity::destroy. Only the queued
+	// entities are touched, so ticks without deaths cost nothing here.
+	void processPendingDestroy()
+	{
+		if (mPendingDestroy.empty())
+			return;
+
+		// Entities can be queued from parallel updates in any order, sort
+		// so the swap-and-pop result is the same every run
+		std::sort(mPendingDestroy.begin(), mPendingDestroy.end(),
+				  [](const Entity *a, const Entity *b)
+				  {
+					  if (a->mTypeId != b->mTypeId)
+						  return a->mTypeId < b->mTypeId;
+					  return a->mSlot < b->mSlot;
+				  });
+
+		// onDestroy may destroy more entities, those are handled this pass
+		for (size_t i = 0; i < mPendingDestroy.size(); ++i)
+		{
+			Entity *e = mPendingDestroy[i];
+			e->onDestroy();
+			mGrid.remove(e);
+			mPools[e->mTypeId]->destroy(e);
+		}
+
+		mPendingDestroy.clear();
+	}
+
+	std::vector<std::unique_ptr<EntityPoolBase>> mPools; // indexed by typeId
+
+	std::mutex mPendingMutex;
+	std::vector<Entity *> mPendingDestroy; // guarded by mPendingMutex
+
+	struct DeferredCommand
+	{
+		uint64_t order;
+		std::function<void(World &)> fn;
+	};
+
+	std::mutex mDeferredMutex;
+	std::vector<DeferredCommand> mDeferred; // guarded by mDeferredMutex
+
+	JobSystem *mJobs = nullptr;
+	bool mInParallelUpdate = false;
+
+	Renderer *mRenderer = nullptr;
+	CullSpheres mCull; // reused every frame
+
+	SpatialHashGrid mGrid;
+
+	friend class Entity;
 };
+
+// Defined here as it needs World. Queues the entity, World::update destroys
+// it at the end of the tick.
+inline void Entity::destroy()
+{
+	// Only the first call queues it, even if several threads race here
+	if (mPendingDestroy.exchange(true))
+		return;
+
+	if (mWorld)
+	{
+		std::lock_guard<std::mutex> lock(mWorld->mPendingMutex);
+		mWorld->mPendingDestroy.push_back(this);
+	}
+}
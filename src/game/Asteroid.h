@@ -8,6 +8,8 @@
 class Asteroid : public ShadowCaster
 {
   public:
+	static constexpr bool kParallelUpdate = true;
+
 	Asteroid();
 	~Asteroid();
 
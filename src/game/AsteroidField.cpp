@@ -0,0 +1,410 @@
+#include "AsteroidField.h"
+
+#include "../engine/Engine.h"
+#include "ShadowCaster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) ||            \
+	defined(__i386__)
+#define ASTEROID_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define ASTEROID_SIMD_X86 0
+#endif
+
+// MSVC allows AVX2 intrinsics anywhere, GCC/Clang need the function tagged
+#if defined(_MSC_VER) && !defined(__clang__)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Same constants as Asteroid::update
+constexpr const float gravity = -30.f;
+constexpr const float groundHeight = 0.f;
+
+constexpr size_t kAlignment = 32;
+
+AlignedFloatArray::~AlignedFloatArray()
+{
+	::operator delete[](mData, std::align_val_t(kAlignment));
+}
+
+void AlignedFloatArray::reserve(size_t newCapacity, size_t count)
+{
+	float *data = static_cast<float *>(
+		::operator new[](newCapacity * sizeof(float),
+						 std::align_val_t(kAlignment)));
+
+	if (mData)
+		memcpy(data, mData, count * sizeof(float));
+	memset(data + count, 0, (newCapacity - count) * sizeof(float));
+
+	::operator delete[](mData, std::align_val_t(kAlignment));
+	mData = data;
+}
+
+void AsteroidField::integrateScalar(float *y, float *yVel, float *age,
+									size_t count, float dt, uint32_t *dead)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		yVel[i] += gravity * dt;
+		y[i] += yVel[i] * dt;
+		age[i] += dt;
+
+		if (y[i] <= groundHeight)
+			dead[i / 32] |= 1u << (i % 32);
+	}
+}
+
+#if ASTEROID_SIMD_X86
+// count must be a multiple of 8
+
+static void integrateSSE(float *y, float *yVel, float *age, size_t count,
+						 float dt, uint32_t *dead)
+{
+	const __m128 gdt = _mm_set1_ps(gravity * dt);
+	const __m128 vdt = _mm_set1_ps(dt);
+	const __m128 ground = _mm_set1_ps(groundHeight);
+
+	for (size_t i = 0; i < count; i += 8)
+	{
+		uint32_t mask = 0;
+
+		for (size_t half = 0; half < 8; half += 4)
+		{
+			__m128 v = _mm_load_ps(yVel + i + half);
+			__m128 p = _mm_load_ps(y + i + half);
+			__m128 a = _mm_load_ps(age + i + half);
+
+			v = _mm_add_ps(v, gdt);
+			p = _mm_add_ps(p, _mm_mul_ps(v, vdt));
+			a = _mm_add_ps(a, vdt);
+
+			_mm_store_ps(yVel + i + half, v);
+			_mm_store_ps(y + i + half, p);
+			_mm_store_ps(age + i + half, a);
+
+			mask |= static_cast<uint32_t>(
+						_mm_movemask_ps(_mm_cmple_ps(p, ground)))
+					<< half;
+		}
+
+		dead[i / 32] |= mask << (i % 32);
+	}
+}
+
+TARGET_AVX2 static void integrateAVX2(float *y, float *yVel, float *age,
+									  size_t count, float dt, uint32_t *dead)
+{
+	const __m256 gdt = _mm256_set1_ps(gravity * dt);
+	const __m256 vdt = _mm256_set1_ps(dt);
+	const __m256 ground = _mm256_set1_ps(groundHeight);
+
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 v = _mm256_load_ps(yVel + i);
+		__m256 p = _mm256_load_ps(y + i);
+		__m256 a = _mm256_load_ps(age + i);
+
+		// Separate mul and add (no FMA) so results match the scalar path
+		v = _mm256_add_ps(v, gdt);
+		p = _mm256_add_ps(p, _mm256_mul_ps(v, vdt));
+		a = _mm256_add_ps(a, vdt);
+
+		_mm256_store_ps(yVel + i, v);
+		_mm256_store_ps(y + i, p);
+		_mm256_store_ps(age + i, a);
+
+		uint32_t mask = static_cast<uint32_t>(
+			_mm256_movemask_ps(_mm256_cmp_ps(p, ground, _CMP_LE_OQ)));
+
+		dead[i / 32] |= mask << (i % 32);
+	}
+}
+
+static bool cpuHasAVX2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx)
+		return false;
+
+	// OS must save the YMM registers
+	if ((_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init(); // may run before libgcc's own init
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+using IntegrateFn = void (*)(float *, float *, float *, size_t, float,
+							 uint32_t *);
+
+static IntegrateFn selectIntegrate()
+{
+#if ASTEROID_SIMD_X86
+	if (cpuHasAVX2())
+		return integrateAVX2;
+	return integrateSSE;
+#else
+	return AsteroidField::integrateScalar;
+#endif
+}
+
+static const IntegrateFn integrate = selectIntegrate();
+
+bool AsteroidField::testKernels(size_t count, int steps)
+{
+	struct Kernel
+	{
+		const char *name;
+		IntegrateFn fn;
+	};
+
+	std::vector<Kernel> kernels;
+#if ASTEROID_SIMD_X86
+	kernels.push_back({"SSE", integrateSSE});
+	if (cpuHasAVX2())
+		kernels.push_back({"AVX2", integrateAVX2});
+	else
+		std::cout << "  AVX2: not supported by this CPU, skipped\n";
+#endif
+
+	// Kernels only take multiples of 8
+	count = (count + 7) & ~size_t(7);
+
+	// Same seed every time so every kernel starts from the same field
+	struct Field
+	{
+		AlignedFloatArray y;
+		AlignedFloatArray yVel;
+		AlignedFloatArray age;
+		std::vector<uint32_t> dead;
+
+		explicit Field(size_t count) : dead(count / 32 + 1)
+		{
+			y.reserve(count, 0);
+			yVel.reserve(count, 0);
+			age.reserve(count, 0);
+
+			std::mt19937 rng(1);
+			std::uniform_real_distribution<float> height(0.f, 40.f);
+			std::uniform_real_distribution<float> speed(-10.f, 10.f);
+			std::uniform_real_distribution<float> seconds(0.f, 5.f);
+			for (size_t i = 0; i < count; ++i)
+			{
+				y[i] = height(rng);
+				yVel[i] = speed(rng);
+				age[i] = seconds(rng);
+			}
+		}
+
+		void run(IntegrateFn fn, size_t count, int steps)
+		{
+			for (int step = 0; step < steps; ++step)
+			{
+				fn(y.data(), yVel.data(), age.data(), count, 1.f / 60.f,
+				   dead.data());
+			}
+		}
+	};
+
+	Field reference(count);
+	reference.run(integrateScalar, count, steps);
+
+	bool ok = true;
+	for (const Kernel &kernel : kernels)
+	{
+		Field field(count);
+		field.run(kernel.fn, count, steps);
+
+		size_t mismatched = 0;
+		float maxError = 0.f;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const float error =
+				std::max({std::fabs(field.y[i] - reference.y[i]),
+						  std::fabs(field.yVel[i] - reference.yVel[i]),
+						  std::fabs(field.age[i] - reference.age[i])});
+			const uint32_t deadDiff =
+				field.dead[i / 32] ^ reference.dead[i / 32];
+
+			if (error != 0.f || (deadDiff >> (i % 32)) & 1u)
+				++mismatched;
+			maxError = std::max(maxError, error);
+		}
+
+		std::cout << "  " << kernel.name << ": "
+				  << (mismatched == 0 ? "ok" : "MISMATCH") << ", "
+				  << mismatched << " asteroids differ, max error " << maxError
+				  << "\n";
+		ok = ok && mismatched == 0;
+	}
+
+	return ok;
+}
+
+AsteroidField::AsteroidField()
+{
+	mShadowTexture =
+		Engine::instance->renderer->loadAtlasTexture("gamedata/Shadow_0.png");
+}
+
+AsteroidField::~AsteroidField()
+{
+	Engine::instance->renderer->deleteTexture(mShadowTexture);
+}
+
+void AsteroidField::spawn(glm::vec3 position)
+{
+	if (mCount == mCapacity)
+	{
+		// Stays a multiple of 8
+		const size_t newCapacity = std::max<size_t>(64, mCapacity * 2);
+
+		mX.reserve(newCapacity, mCount);
+		mY.reserve(newCapacity, mCount);
+		mZ.reserve(newCapacity, mCount);
+		mYVel.reserve(newCapacity, mCount);
+		mAge.reserve(newCapacity, mCount);
+
+		mCapacity = newCapacity;
+		mDead.resize(mCapacity / 32 + 1);
+	}
+
+	mX[mCount] = position.x;
+	mY[mCount] = position.y;
+	mZ[mCount] = position.z;
+	mYVel[mCount] = 0.f;
+	mAge[mCount] = 0.f;
+	++mCount;
+}
+
+void AsteroidField::update(float dt)
+{
+	if (mCount == 0)
+		return;
+
+	std::fill(mDead.begin(), mDead.end(), 0u);
+
+	// Lanes past mCount hold stale or zeroed data, their results are
+	// ignored by removeDead
+	const size_t paddedCount = (mCount + 7) & ~size_t(7);
+
+	// Chunks are a multiple of 32 so no two share a word of mDead
+	constexpr size_t kChunk = 16384;
+	auto integrateRange = [this, dt](size_t begin, size_t end)
+	{
+		integrate(mY.data() + begin, mYVel.data() + begin,
+				  mAge.data() + begin, end - begin, dt,
+				  mDead.data() + begin / 32);
+	};
+
+	JobSystem *jobs = Engine::instance->jobs.get();
+	if (jobs && paddedCount > kChunk)
+		jobs->parallelFor(paddedCount, kChunk, integrateRange);
+	else
+		integrateRange(0, paddedCount);
+
+	removeDead();
+}
+
+void AsteroidField::removeDead()
+{
+	// Back to front, so whatever gets swapped in from the end has already
+	// been checked
+	for (size_t word = (mCount - 1) / 32 + 1; word-- > 0;)
+	{
+		uint32_t bits = mDead[word];
+		while (bits)
+		{
+			// Highest set bit first
+			uint32_t bit = 31;
+			while (!(bits & (1u << bit)))
+				--bit;
+			bits &= ~(1u << bit);
+
+			const size_t i = word * 32 + bit;
+			if (i >= mCount)
+				continue;
+
+			const size_t last = --mCount;
+			mX[i] = mX[last];
+			mY[i] = mY[last];
+			mZ[i] = mZ[last];
+			mYVel[i] = mYVel[last];
+			mAge[i] = mAge[last];
+		}
+	}
+}
+
+void AsteroidField::render()
+{
+	auto *renderer = Engine::instance->renderer.get();
+
+	// Spheres around each asteroid and its shadow, they share x and z with
+	// the asteroid so only y and the radius need filling in
+	mCullY.resize(mCount);
+	mCullRadius.resize(mCount);
+	mVisible.resize(mCount);
+	for (size_t i = 0; i < mCount; ++i)
+	{
+		glm::vec3 center;
+		ShadowCaster::boundingSphere(glm::vec3(mX[i], mY[i], mZ[i]), center,
+									 mCullRadius[i]);
+		mCullY[i] = center.y;
+	}
+
+	const size_t drawn = renderer->frustum().cullSpheres(
+		mX.data(), mCullY.data(), mZ.data(), mCullRadius.data(), mCount,
+		mVisible.data());
+	renderer->countCulling(static_cast<uint32_t>(drawn),
+						   static_cast<uint32_t>(mCount - drawn));
+
+	for (size_t i = 0; i < mCount; ++i)
+	{
+		if (!mVisible[i])
+			continue;
+
+		const glm::vec3 position(mX[i], mY[i], mZ[i]);
+
+		ShadowCaster::drawShadow(position, mShadowTexture);
+
+		renderer->drawQuad(position, glm::vec3(0, 0, 0),
+						   glm::vec3(0.5f, 0.5f, 0.5f), glm::vec4(1, 1, 1, 1));
+	}
+}
+
+bool AsteroidField::bounds(glm::vec3 &min, glm::vec3 &max) const
+{
+	if (mCount == 0)
+		return false;
+
+	for (size_t i = 0; i < mCount; ++i)
+	{
+		const glm::vec3 p(mX[i], mY[i], mZ[i]);
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	return true;
+}
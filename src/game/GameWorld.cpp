@@ -119,7 +119,7 @@ Light_params lightParams;
 
 void GameWorld::init()
 {
-	mPlayer = createEntity<Player>();
+	mPlayer = handleOf(createEntity<Player>());
 
 	// mesh = Engine::instance->renderer->createQuadMesh();
 	mesh = Engine::instance->renderer->loadMesh("gamedata/Suzanne.obj");
@@ -149,9 +149,11 @@ void GameWorld::update(float dt)
 {
 	World::update(dt);
 
+	mAsteroidField.update(dt);
+
 	auto *cam = Engine::instance->camera.get();
 
-	glm::vec3 playerTarget = mPlayer->position;
+	glm::vec3 playerTarget = get(mPlayer)->position;
 	playerTarget.y += cameraParams.playerHeight;
 	std::vector<glm::vec3> targets = {playerTarget};
 
@@ -170,6 +172,8 @@ void GameWorld::update(float dt)
 		max = glm::max(max, p);
 	}
 
+	mAsteroidField.bounds(min, max);
+
 	glm::vec3 center = (min + max) * 0.5f;
 	glm::vec3 extents = max - min;
 
@@ -198,17 +202,41 @@ void GameWorld::update(float dt)
 		asteroid->position = randomPointInCube(glm::vec3(0, 4.5f, 0), 5);
 	}
 
+	// Stress test for the SoA path
+	if (Engine::instance->input->pressed(SDLK_X))
+	{
+		for (int i = 0; i < 1000; ++i)
+		{
+			mAsteroidField.spawn(
+				randomPointInCube(glm::vec3(0, 4.5f, 0), 5));
+		}
+	}
+
 	Engine::instance->renderer->setLighting(
 		lightParams.lightPos, lightParams.lightColor, lightParams.ambient);
 }
 
 void GameWorld::render()
 {
-	Engine::instance->renderer->drawQuad(
-		glm::vec3(0, 0, 0), glm::vec3(-90, 0, 0), glm::vec3(10, 10, 10),
-		glm::vec4(104 / 255.f, 218 / 255.f, 100 / 255.f, 1));
+	auto *renderer = Engine::instance->renderer.get();
 
-	Engine::instance->renderer->drawMesh(mesh, glm::mat4(1.0f));
+	// Ground, 10x10 on the xz plane
+	if (renderer->frustum().intersectsAabb(glm::vec3(-5, 0, -5),
+										   glm::vec3(5, 0, 5)))
+	{
+		renderer->drawQuad(glm::vec3(0, 0, 0), glm::vec3(-90, 0, 0),
+						   glm::vec3(10, 10, 10),
+						   glm::vec4(104 / 255.f, 218 / 255.f, 100 / 255.f, 1));
+		renderer->countCulling(1, 0);
+	}
+	else
+	{
+		renderer->countCulling(0, 1);
+	}
+
+	renderer->drawMesh(mesh, glm::mat4(1.0f));
 
 	World::render();
+
+	mAsteroidField.render();
 }
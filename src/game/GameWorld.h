@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "../engine/World.h"
+#include "AsteroidField.h"
 
 class Player;
 class Asteroid;
@@ -18,6 +19,8 @@ class GameWorld : public World
 	virtual void render() override;
 
   private:
-	Player *mPlayer = nullptr;
+	EntityHandle<Player> mPlayer;
 	Mesh mesh;
+
+	AsteroidField mAsteroidField;
 };
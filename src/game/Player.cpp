@@ -4,7 +4,8 @@
 
 Player::Player()
 {
-	texture = Engine::instance->renderer->loadTexture("gamedata/Stick.png");
+	texture =
+		Engine::instance->renderer->loadAtlasTexture("gamedata/Stick.png");
 }
 
 Player::~Player()
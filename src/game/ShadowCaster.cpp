@@ -2,10 +2,29 @@
 
 #include "../engine/Engine.h"
 
+#include <algorithm>
+
+constexpr const float groundY = 0.f;
+constexpr const float lightHeight = 10.f;
+
+// Size of the shadow quad for a caster at height y. yTop is the top of the
+// sprite, clamped between the ground and the light.
+static float shadowScale(float y, float &yTop)
+{
+	yTop = y + 1.f /* top of sprite */;
+
+	// clamp yTop to avoid division by zero / crossing light plane
+	const float eps = 0.001f;
+	yTop = glm::clamp(yTop, groundY + eps, lightHeight - eps);
+
+	// physically-based scale for a point light straight above
+	return (lightHeight - groundY) / (lightHeight - yTop) * 0.5f;
+}
+
 ShadowCaster::ShadowCaster()
 {
 	shadowTexture =
-		Engine::instance->renderer->loadTexture("gamedata/Shadow_0.png");
+		Engine::instance->renderer->loadAtlasTexture("gamedata/Shadow_0.png");
 }
 
 ShadowCaster::~ShadowCaster()
@@ -13,22 +32,14 @@ ShadowCaster::~ShadowCaster()
 	Engine::instance->renderer->deleteTexture(shadowTexture);
 }
 
-void ShadowCaster::drawShadow()
+void ShadowCaster::drawShadow() { drawShadow(position, shadowTexture); }
+
+void ShadowCaster::drawShadow(glm::vec3 position, Texture shadowTexture)
 {
-	constexpr const float groundY = 0.f;
-	constexpr const float lightHeight = 10.f;
-	constexpr const float baseShadowScale = 1.f;
 	constexpr const float minAlpha = 0.1f;
 
-	float yTop = position.y + 1.f /* top of sprite */;
-
-	// clamp yTop to avoid division by zero / crossing light plane
-	const float eps = 0.001f;
-	yTop = glm::clamp(yTop, groundY + eps, lightHeight - eps);
-
-	// physically-based scale for a point light straight above
-	float shadowScale = (lightHeight - groundY) / (lightHeight - yTop);
-	shadowScale *= 0.5f;
+	float yTop;
+	const float scale = shadowScale(position.y, yTop);
 
 	// alpha approximation: higher object => smaller (lighter) shadow
 	float shadowAlpha = glm::clamp(
@@ -38,6 +49,27 @@ void ShadowCaster::drawShadow()
 	glm::vec3 shadowPos(position.x, groundY + 0.01f, position.z);
 
 	Engine::instance->renderer->drawQuad(
-		shadowPos, glm::vec3(-90, 0, 0), glm::vec3(shadowScale),
+		shadowPos, glm::vec3(-90, 0, 0), glm::vec3(scale),
 		glm::vec4(1, 1, 1, shadowAlpha), shadowTexture);
 }
+
+void ShadowCaster::boundingSphere(glm::vec3 position, glm::vec3 &center,
+								  float &radius)
+{
+	// Covers a unit sprite drawn up to half a unit above position
+	constexpr const float spriteRadius = 1.2f;
+
+	// Half the diagonal of the shadow quad
+	float yTop;
+	const float shadowRadius = shadowScale(position.y, yTop) * 0.71f;
+
+	// Cylinder from the shadow up to the top of the sprite, then the sphere
+	// around that
+	const float bottom = std::min(groundY, position.y - spriteRadius);
+	const float top = position.y + spriteRadius;
+	const float halfHeight = (top - bottom) * 0.5f;
+	const float horizontal = std::max(spriteRadius, shadowRadius);
+
+	center = glm::vec3(position.x, bottom + halfHeight, position.z);
+	radius = std::sqrt(halfHeight * halfHeight + horizontal * horizontal);
+}
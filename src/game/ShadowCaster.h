@@ -11,6 +11,19 @@ class ShadowCaster : public Entity
 	ShadowCaster();
 	~ShadowCaster();
 
+	// Blob shadow on the ground below position, shared with non-entity
+	// shadow casters such as AsteroidField
+	static void drawShadow(glm::vec3 position, Texture shadowTexture);
+
+	// Sphere around a caster's sprite and its shadow, hides
+	// Entity::boundingSphere so the shadow isn't culled while visible
+	static void boundingSphere(glm::vec3 position, glm::vec3 &center,
+							   float &radius);
+	void boundingSphere(glm::vec3 &center, float &radius) const
+	{
+		boundingSphere(position, center, radius);
+	}
+
   protected:
 	void drawShadow();
 
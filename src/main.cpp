@@ -3,55 +3,627 @@
 #include <SDL3/SDL.h>
 
 #include "engine/Engine.h"
+#include "engine/MeshAsset.h"
+#include "engine/Profiler.h"
+#include "engine/SpatialHashGrid.h"
+#include "engine/TextureAsset.h"
+#include "engine/World.h"
+#include "game/AsteroidField.h"
 #include "game/GameWorld.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+struct LaunchOptions
+{
+	// Hidden window, offscreen rendering, exactly `frames` frames each
+	// advancing one fixed step
+	bool headless = false;
+	int frames = 600;
+
+	// Frames to write as PNG, headless only
+	std::vector<int> captureFrames;
+	std::string captureDir = "captures";
+
+	// Cook every image in this directory and exit, no window
+	std::string cookTexturesDir;
+
+	// Time the spatial hash grid with this many moving entities and exit
+	int benchGridEntities = 0;
+
+	// Time creating and destroying this many entities and exit
+	int benchEntities = 0;
+
+	// Time frustum culling this many bounding spheres and exit
+	int benchCullSpheres = 0;
+
+	// Time this many draws with and without the GL state and uniform
+	// location caches, in a hidden window, and exit
+	int benchDrawState = 0;
+
+	// Import every OBJ at this path (a file or a directory), report the
+	// import time and vertex cache efficiency, and exit
+	std::string benchMeshPath;
+
+	// Check the SIMD asteroid kernels against the scalar one and exit
+	int testAsteroids = 0;
+};
+
+// --headless [--frames N] [--capture 0,10,599] [--capture-dir DIR]
+// --cook-textures DIR
+// --bench-grid [N]
+// --bench-entities [N]
+// --bench-cull [N]
+// --bench-mesh PATH
+// --bench-draw-state [N]
+// --test-asteroids [N]
+static bool parseArgs(int argc, char *argv[], LaunchOptions &options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+		if (strcmp(arg, "--headless") == 0)
+		{
+			options.headless = true;
+		}
+		else if (strcmp(arg, "--frames") == 0 && value)
+		{
+			options.frames = std::max(1, atoi(value));
+			++i;
+		}
+		else if (strcmp(arg, "--capture") == 0 && value)
+		{
+			for (const char *c = value; *c;)
+			{
+				options.captureFrames.push_back(atoi(c));
+				c = strchr(c, ',');
+				if (!c)
+					break;
+				++c;
+			}
+			++i;
+		}
+		else if (strcmp(arg, "--capture-dir") == 0 && value)
+		{
+			options.captureDir = value;
+			++i;
+		}
+		else if (strcmp(arg, "--cook-textures") == 0 && value)
+		{
+			options.cookTexturesDir = value;
+			++i;
+		}
+		else if (strcmp(arg, "--bench-grid") == 0)
+		{
+			options.benchGridEntities = 100000;
+			if (value && value[0] != '-')
+			{
+				options.benchGridEntities = std::max(1, atoi(value));
+				++i;
+			}
+		}
+		else if (strcmp(arg, "--bench-entities") == 0)
+		{
+			options.benchEntities = 100000;
+			if (value && value[0] != '-')
+			{
+				options.benchEntities = std::max(1, atoi(value));
+				++i;
+			}
+		}
+		else if (strcmp(arg, "--bench-cull") == 0)
+		{
+			options.benchCullSpheres = 100000;
+			if (value && value[0] != '-')
+			{
+				options.benchCullSpheres = std::max(1, atoi(value));
+				++i;
+			}
+		}
+		else if (strcmp(arg, "--bench-mesh") == 0 && value)
+		{
+			options.benchMeshPath = value;
+			++i;
+		}
+		else if (strcmp(arg, "--bench-draw-state") == 0)
+		{
+			options.benchDrawState = 10000;
+			if (value && value[0] != '-')
+			{
+				options.benchDrawState = std::max(1, atoi(value));
+				++i;
+			}
+		}
+		else if (strcmp(arg, "--test-asteroids") == 0)
+		{
+			options.testAsteroids = 100000;
+			if (value && value[0] != '-')
+			{
+				options.testAsteroids = std::max(1, atoi(value));
+				++i;
+			}
+		}
+		else
+		{
+			std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Recooks every PNG/JPG in dir and prints what each costs in VRAM as
+// RGBA8 against the cooked mip chain. That saving only applies to images
+// loaded with loadTexture or loadTextureAsync, loadAtlasTexture never
+// uses the cooked file.
+static bool cookTextures(const std::string &dir)
+{
+	size_t totalRaw = 0;
+	size_t totalCooked = 0;
+	bool ok = true;
+
+	for (const auto &entry : std::filesystem::directory_iterator(dir))
+	{
+		const std::string extension = entry.path().extension().string();
+		if (extension != ".png" && extension != ".jpg")
+			continue;
+
+		const std::string source = entry.path().string();
+		const std::string cooked = cookedTexturePath(source.c_str());
+
+		CookedTexture texture;
+		if (!cookTexture(source.c_str(), cooked.c_str()) ||
+			!texture.open(cooked.c_str()))
+		{
+			std::cerr << "Failed to cook " << source << "\n";
+			ok = false;
+			continue;
+		}
+
+		const TextureFileHeader &header = texture.header();
+		const size_t raw = size_t(header.width) * header.height * 4;
+		totalRaw += raw;
+		totalCooked += texture.dataSize();
+
+		const bool bc1 = texture.format() == TextureFormat::BC1;
+		std::cout << source << ": " << header.width << "x" << header.height
+				  << (bc1 ? " BC1, " : " BC3, ") << header.mipCount
+				  << " mips, " << raw << " -> " << texture.dataSize()
+				  << " bytes\n";
+	}
+
+	if (totalRaw > 0)
+	{
+		std::cout << "Total " << totalRaw << " -> " << totalCooked
+				  << " bytes, " << 100.0 * (totalRaw - totalCooked) / totalRaw
+				  << "% less VRAM for images loaded with loadTexture or "
+					 "loadTextureAsync\n"
+				  << "Images loaded with loadAtlasTexture are not cooked, "
+					 "they stay RGBA8 in the atlas\n";
+	}
+
+	return ok;
+}
+
+// Moves count entities through a spatial hash grid for a second of fixed
+// steps, each step finding every entity's neighbours. Compares that with
+// checking every pair, estimated from a sample.
+static void benchSpatialGrid(int count)
+{
+	struct Mover : Entity
+	{
+		glm::vec3 velocity;
+	};
+
+	constexpr int kTicks = 60;
+	constexpr float kDt = 1.f / kTicks;
+	constexpr float kRadius = 1.f;
+	constexpr int kBruteSample = 1000;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> spread(-250.f, 250.f);
+	std::uniform_real_distribution<float> height(0.f, 20.f);
+	std::uniform_real_distribution<float> speed(-5.f, 5.f);
+
+	std::vector<Mover> movers(count);
+	SpatialHashGrid grid;
+	for (Mover &m : movers)
+	{
+		m.position = glm::vec3(spread(rng), height(rng), spread(rng));
+		m.velocity = glm::vec3(speed(rng), speed(rng), speed(rng));
+		grid.insert(&m);
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d)
+	{ return std::chrono::duration<double, std::milli>(d).count(); };
+
+	Clock::duration updateTime{}, queryTime{};
+	size_t pairs = 0;
+
+	for (int tick = 0; tick < kTicks; ++tick)
+	{
+		for (Mover &m : movers)
+			m.position += m.velocity * kDt;
+
+		auto start = Clock::now();
+		for (Mover &m : movers)
+			grid.update(&m);
+		updateTime += Clock::now() - start;
+
+		start = Clock::now();
+		for (Mover &m : movers)
+			grid.queryRadius(m.position, kRadius, [&](Entity *) { ++pairs; });
+		queryTime += Clock::now() - start;
+	}
+
+	// Every pair for a sample of entities, scaled up to all of them
+	const int sample = std::min(count, kBruteSample);
+	size_t brutePairs = 0;
+	const auto bruteStart = Clock::now();
+	for (int i = 0; i < sample; ++i)
+	{
+		for (const Mover &other : movers)
+		{
+			const glm::vec3 d = other.position - movers[i].position;
+			brutePairs += glm::dot(d, d) <= kRadius * kRadius;
+		}
+	}
+	const double bruteMs =
+		ms(Clock::now() - bruteStart) * (double(count) / sample);
+
+	std::cout << count << " entities, " << kTicks << " ticks\n"
+			  << "  grid update  " << ms(updateTime) / kTicks << " ms/tick\n"
+			  << "  grid queries " << ms(queryTime) / kTicks
+			  << " ms/tick, " << pairs / kTicks << " neighbours/tick\n"
+			  << "  every pair   ~" << bruteMs << " ms/tick ("
+			  << brutePairs << " neighbours for " << sample
+			  << " entities)\n";
+}
+
+// Spawns count entities into a World and destroys them again, a few
+// rounds so later ones reuse the pool's free slots. The same entities made
+// with new/delete are timed alongside for comparison.
+static void benchEntityPool(int count)
+{
+	// Stands in for Asteroid, which loads its shadow texture through the
+	// renderer: constructed from a position, falls every update
+	struct FallingRock : Entity
+	{
+		explicit FallingRock(glm::vec3 start) { position = start; }
+
+		void update(float dt) override
+		{
+			yVel += -30.f * dt;
+			position.y += yVel * dt;
+		}
+
+		Texture shadowTexture{};
+		float yVel = 0.f;
+	};
+
+	constexpr int kRounds = 10;
+	constexpr float kDt = 1.f / 60.f;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> spread(-250.f, 250.f);
+	std::vector<glm::vec3> positions(count);
+	for (glm::vec3 &p : positions)
+		p = glm::vec3(spread(rng), 0.f, spread(rng));
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d)
+	{ return std::chrono::duration<double, std::milli>(d).count(); };
+
+	World world;
+	std::vector<FallingRock *> spawned(count);
+	Clock::duration createTime{}, destroyTime{};
+
+	for (int round = 0; round < kRounds; ++round)
+	{
+		auto start = Clock::now();
+		for (int i = 0; i < count; ++i)
+			spawned[i] = world.createEntity<FallingRock>(positions[i]);
+		createTime += Clock::now() - start;
+
+		// Destruction happens in the world's update, which also ticks
+		// every rock once more
+		start = Clock::now();
+		for (FallingRock *e : spawned)
+			e->destroy();
+		world.update(kDt);
+		destroyTime += Clock::now() - start;
+	}
+
+	std::vector<std::unique_ptr<FallingRock>> heap(count);
+	Clock::duration heapTime{};
+	for (int round = 0; round < kRounds; ++round)
+	{
+		const auto start = Clock::now();
+		for (int i = 0; i < count; ++i)
+			heap[i] = std::make_unique<FallingRock>(positions[i]);
+		for (auto &e : heap)
+			e.reset();
+		heapTime += Clock::now() - start;
+	}
+
+	std::cout << count << " entities, " << kRounds << " rounds\n"
+			  << "  createEntity    " << ms(createTime) / kRounds
+			  << " ms/round\n"
+			  << "  destroy + tick  " << ms(destroyTime) / kRounds
+			  << " ms/round\n"
+			  << "  new/delete      " << ms(heapTime) / kRounds
+			  << " ms/round (no world)\n";
+}
+
+// Culls count spheres scattered over the field against the renderer's
+// projection from the default camera, the way World::render does each
+// frame, with the SSE and scalar paths. No window, only the CPU side.
+static bool benchCulling(int count)
+{
+	constexpr int kRuns = 100;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> spread(-250.f, 250.f);
+	std::uniform_real_distribution<float> height(0.f, 20.f);
+	std::uniform_real_distribution<float> size(0.5f, 2.f);
+
+	std::vector<float> x(count), y(count), z(count), radius(count);
+	for (int i = 0; i < count; ++i)
+	{
+		x[i] = spread(rng);
+		y[i] = height(rng);
+		z[i] = spread(rng);
+		radius[i] = size(rng);
+	}
+
+	// Same projection as Renderer::beginFrame
+	Camera camera;
+	const glm::mat4 projection =
+		glm::perspective(glm::radians(50.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+	const Frustum frustum =
+		Frustum::fromMatrix(projection * camera.getViewMatrix());
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d)
+	{ return std::chrono::duration<double, std::milli>(d).count(); };
+
+	std::vector<uint8_t> visible(count), visibleScalar(count);
+	size_t drawn = 0, drawnScalar = 0;
+
+	auto start = Clock::now();
+	for (int run = 0; run < kRuns; ++run)
+	{
+		drawn = frustum.cullSpheres(x.data(), y.data(), z.data(),
+									radius.data(), count, visible.data());
+	}
+	const double simdMs = ms(Clock::now() - start) / kRuns;
+
+	start = Clock::now();
+	for (int run = 0; run < kRuns; ++run)
+	{
+		drawnScalar = frustum.cullSpheresScalar(x.data(), y.data(), z.data(),
+												radius.data(), count,
+												visibleScalar.data());
+	}
+	const double scalarMs = ms(Clock::now() - start) / kRuns;
+
+	std::cout << count << " spheres, " << drawn << " drawn, "
+			  << count - drawn << " culled\n"
+			  << "  cullSpheres        " << simdMs << " ms\n"
+			  << "  cullSpheresScalar  " << scalarMs << " ms\n";
+
+	if (drawn != drawnScalar || visible != visibleScalar)
+	{
+		std::cerr << "SSE and scalar culling disagree\n";
+		return false;
+	}
+
+	return true;
+}
+
+// Imports each OBJ the way loadMesh does on a cache miss, printing the
+// import and optimize times and the ACMR before and after reordering.
+// Nothing is cooked.
+static bool benchMeshes(const std::string &path)
+{
+	std::vector<std::filesystem::path> files;
+	if (std::filesystem::is_directory(path))
+	{
+		for (const auto &entry : std::filesystem::directory_iterator(path))
+		{
+			if (entry.path().extension() == ".obj")
+				files.push_back(entry.path());
+		}
+		std::sort(files.begin(), files.end());
+	}
+	else
+	{
+		files.push_back(path);
+	}
+
+	if (files.empty())
+	{
+		std::cerr << "No .obj files in " << path << "\n";
+		return false;
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d)
+	{ return std::chrono::duration<double, std::milli>(d).count(); };
+
+	bool ok = true;
+	for (const auto &file : files)
+	{
+		const std::string source = file.string();
+
+		try
+		{
+			const auto importStart = Clock::now();
+			MeshData mesh = importObj(source.c_str());
+			const auto importEnd = Clock::now();
+
+			const float acmrBefore =
+				computeAcmr(mesh.indices, mesh.vertices.size());
+
+			const auto optimizeStart = Clock::now();
+			optimizeVertexCache(mesh.indices, mesh.vertices.size());
+			optimizeVertexFetch(mesh);
+			const auto optimizeEnd = Clock::now();
+
+			const float acmrAfter =
+				computeAcmr(mesh.indices, mesh.vertices.size());
+
+			std::cout << source << ": " << mesh.vertices.size()
+					  << " vertices, " << mesh.indices.size() / 3
+					  << " triangles\n"
+					  << "  import   " << ms(importEnd - importStart)
+					  << " ms\n"
+					  << "  optimize " << ms(optimizeEnd - optimizeStart)
+					  << " ms\n"
+					  << "  ACMR     " << acmrBefore << " -> " << acmrAfter
+					  << "\n";
+		}
+		catch (const std::exception &e)
+		{
+			std::cerr << e.what() << "\n";
+			ok = false;
+		}
+	}
+
+	return ok;
+}
 
 int main(int argc, char *argv[])
 {
 	try
 	{
+		LaunchOptions options;
+		if (!parseArgs(argc, argv, options))
+			return 1;
+
+		if (!options.cookTexturesDir.empty())
+			return cookTextures(options.cookTexturesDir) ? 0 : 1;
+
+		if (options.benchGridEntities > 0)
+		{
+			benchSpatialGrid(options.benchGridEntities);
+			return 0;
+		}
+
+		if (options.benchCullSpheres > 0)
+			return benchCulling(options.benchCullSpheres) ? 0 : 1;
+
+		if (!options.benchMeshPath.empty())
+			return benchMeshes(options.benchMeshPath) ? 0 : 1;
+
+		if (options.benchEntities > 0)
+		{
+			benchEntityPool(options.benchEntities);
+			return 0;
+		}
+
+		if (options.testAsteroids > 0)
+		{
+			constexpr int kSteps = 120;
+			std::cout << options.testAsteroids << " asteroids, " << kSteps
+					  << " steps\n";
+			return AsteroidField::testKernels(options.testAsteroids, kSteps)
+					   ? 0
+					   : 1;
+		}
+
 		Engine engine;
 
-		if (!engine.init())
+		if (!engine.init(options.headless || options.benchDrawState > 0))
 			return 1;
 
+		if (options.benchDrawState > 0)
+		{
+			double cachedMs, uncachedMs;
+			engine.renderer->beginFrame();
+			engine.renderer->benchDrawState(options.benchDrawState, cachedMs,
+											uncachedMs);
+			engine.renderer->endFrame();
+
+			std::cout << options.benchDrawState << " draws\n"
+					  << "  state cache on  " << cachedMs << " ms\n"
+					  << "  state cache off " << uncachedMs << " ms\n";
+			return 0;
+		}
+
 		engine.setWorld(std::make_unique<GameWorld>());
 
+		if (!options.captureFrames.empty())
+			std::filesystem::create_directories(options.captureDir);
+
+		const auto startTime = std::chrono::steady_clock::now();
+
 		// Main loop
 		double lastTime = SDL_GetTicks() * 0.001;
 		double accumulator = 0.0;
 		bool running = true;
+		int frame = 0;
 		SDL_Event e;
 		while (running)
 		{
-			double now = SDL_GetTicks() * 0.001;
-			double frameTime = now - lastTime;
-			lastTime = now;
+			PROFILE_FRAME();
 
-			frameTime = std::min(frameTime, 0.25);
+			double frameTime;
+			if (options.headless)
+			{
+				// One fixed step per frame regardless of wall time, so runs
+				// are repeatable
+				frameTime = engine.fixedDelta;
+			}
+			else
+			{
+				double now = SDL_GetTicks() * 0.001;
+				frameTime = now - lastTime;
+				lastTime = now;
+
+				frameTime = std::min(frameTime, 0.25);
+			}
 			accumulator += frameTime;
 
 			// --- Handle inputs
 			// ---------------------------------------------------
-			engine.input->beginFrame();
-
-			while (SDL_PollEvent(&e))
 			{
+				PROFILE_SCOPE("Input");
+
+				engine.input->beginFrame();
+
+				while (SDL_PollEvent(&e))
+				{
 #if WITH_EDITOR
-				engine.editor->processEvent(e);
+					engine.editor->processEvent(e);
 #endif
 
-				if (e.type == SDL_EVENT_QUIT)
-					running = false;
+					if (e.type == SDL_EVENT_QUIT)
+						running = false;
 
-				engine.input->handleEvent(e);
+					engine.input->handleEvent(e);
+				}
 			}
 
 			// --- Handle updates
 			// --------------------------------------------------
 			while (accumulator >= engine.fixedDelta)
 			{
+				PROFILE_SCOPE("Update");
+
 				if (engine.mode == 0) // Game mode
 				{
 					engine.world->update((float)engine.fixedDelta);
@@ -68,22 +640,67 @@ int main(int argc, char *argv[])
 
 			// --- Rendering
 			// -------------------------------------------------------
-			engine.renderer->beginFrame();
-			engine.renderer->clear(0.2f, 0.3f, 0.6f);
-			//engine.world->render();
-			engine.renderer->endFrame();
+			{
+				PROFILE_SCOPE("Render");
+
+				engine.renderer->beginFrame();
+				engine.renderer->clear(0.2f, 0.3f, 0.6f);
+				//engine.world->render();
+				engine.renderer->endFrame();
+			}
+
+			{
+				PROFILE_SCOPE("UI");
+
+				engine.renderer->begin2D(1280, 720);
+				engine.testUI->Render();
+				engine.renderer->end2D();
+			}
 
-			engine.renderer->begin2D(1280, 720);
-			engine.testUI->Render();
-			engine.renderer->end2D();
+			if (options.headless &&
+				std::find(options.captureFrames.begin(),
+						  options.captureFrames.end(),
+						  frame) != options.captureFrames.end())
+			{
+				char path[32];
+				snprintf(path, sizeof(path), "frame_%04d.png", frame);
+				engine.renderer->saveFrame(
+					(std::filesystem::path(options.captureDir) / path)
+						.string()
+						.c_str());
+			}
 
 #if WITH_EDITOR
-			engine.editor->beginFrame();
-			engine.editor->draw();
-			engine.editor->endFrame();
+			// Not in headless runs, ImGui animates on wall time
+			if (!options.headless)
+			{
+				PROFILE_SCOPE("Editor");
+
+				engine.editor->beginFrame();
+				engine.editor->draw();
+				engine.editor->endFrame();
+			}
 #endif
 
-			SDL_GL_SwapWindow(engine.window);
+			if (!options.headless)
+			{
+				PROFILE_SCOPE("Swap");
+				SDL_GL_SwapWindow(engine.window);
+			}
+
+			if (options.headless && ++frame >= options.frames)
+				running = false;
+		}
+
+		if (options.headless)
+		{
+			const double seconds = std::chrono::duration<double>(
+									   std::chrono::steady_clock::now() -
+									   startTime)
+									   .count();
+
+			std::cout << frame << " frames in " << seconds << " s, "
+					  << seconds * 1000.0 / frame << " ms/frame" << std::endl;
 		}
 
 		return 0;